@@ -6,7 +6,8 @@
 
 typedef enum {
 	EVALUATION_RESULT_MATCH_FOUND,
-	EVALUATION_RESULT_NO_MATCH_FOUND
+	EVALUATION_RESULT_NO_MATCH_FOUND,
+	EVALUATION_RESULT_CANCELLED
 } evaluation_status_t;
 
 class AbstractEvaluationResultImpl : virtual public ReferenceCounted, public ThreadTaskResultImpl {
@@ -30,6 +31,9 @@ public:
 	inline ~AbstractEvaluatorImpl() { }
 
 	virtual bool Evaluate(AbstractEvaluationResult *lpOutput) = 0;
+	/* what is being searched for, evaluators with the same identifier are interchangeable */
+	virtual std::string Identifier() = 0;
+	inline bool Cancelled() { return oToken->IsCancelled(); }
 	inline unsigned long Execute(void* lpPrivate) {
 		AbstractEvaluationResult oResult;
 		bool bEvaluationResult = Evaluate(&oResult);
@@ -46,6 +50,7 @@ public:
 		T oEvaluator(T::create(std::forward<Args>(args)...));
 		oEvaluator->oThreadPool = oThreadPool;
 		oEvaluator->oCodeGraph = oCodeGraph;
+		oEvaluator->oToken = oCodeGraph->toCodeGraph()->Token();
 		oEvaluator->dwMaxEvaluationTime = dwMaxEvaluationTime;
 		oThreadPool->Schedule(oEvaluator->toThreadTask(), NULL);
 		return oEvaluator->toAbstract();
@@ -53,6 +58,7 @@ public:
 
 	ThreadPool oThreadPool;
 	Broker oCodeGraph;
+	CancellationToken oToken;
 	int dwMaxEvaluationTime;
 };
 
@@ -85,6 +91,30 @@ public:
 		}
 		return true;
 	}
+	inline bool Matched() {
+		iterator it;
+		for (it = begin(); it != end(); it++) {
+			if (it->second != nullptr && it->second->eStatus == EVALUATION_RESULT_MATCH_FOUND) {
+				return true;
+			}
+		}
+		return false;
+	}
+	/* cancelled before anything was found, nothing worth reporting */
+	inline bool Cancelled() {
+		iterator it;
+		bool bCancelled = false;
+		for (it = begin(); it != end(); it++) {
+			if (it->second == nullptr) {
+				continue;
+			}
+			if (it->second->eStatus == EVALUATION_RESULT_MATCH_FOUND) {
+				return false;
+			}
+			bCancelled |= it->second->eStatus == EVALUATION_RESULT_CANCELLED;
+		}
+		return bCancelled;
+	}
 
 	Broker oCodeGraph;
 };
@@ -3,12 +3,14 @@
 #include <idp.hpp>
 #include <allins.hpp>
 #include <segregs.hpp>
+#include <bytes.hpp>
 
 #include "common.hpp"
 #include "Arm.hpp"
 #include "DFGraph.hpp"
 #include "Broker.hpp"
 #include "Condition.hpp"
+#include "PathOracle.hpp"
 
 typedef enum {
 	LSL,          // logical left         LSL #0 - don't shift
@@ -933,7 +935,8 @@ _always:
 		} else if (eVerdict == GRAPH_PROCESS_INTERNAL_ERROR) {
 			return PROCESSOR_STATUS_INTERNAL_ERROR;
 		}
-		break;
+		/* condition holds -> branch is taken */
+		return JumpToNode(oBuilder, lpNextAddress, lpAddress, oBuilder->NewConstant(stInstruction.ops[1].addr));
 	}
 	case ARM_ret: {
 		DFGNode oAddress = GetRegister(oBuilder, lpAddress, 14);
@@ -982,6 +985,290 @@ bool ArmImpl::ShouldClean(DFGNode & oNode) {
 	return true;
 }
 
+/* flags of (a - b), or (a + b) for CMN/ADDS, tested against a condition code */
+static bool EvaluateCondition(char cCondition, unsigned int a, unsigned int b, bool bAdd) {
+	unsigned int dwResult = bAdd ? a + b : a - b;
+	bool N = !!(dwResult & 0x80000000);
+	bool Z = dwResult == 0;
+	bool C = bAdd ? dwResult < a : a >= b;
+	bool V = bAdd ? !!(~(a ^ b) & (a ^ dwResult) & 0x80000000) : !!((a ^ b) & (a ^ dwResult) & 0x80000000);
+
+	switch (cCondition) {
+	case cEQ: return Z;
+	case cNE: return !Z;
+	case cCS: return C;
+	case cCC: return !C;
+	case cMI: return N;
+	case cPL: return !N;
+	case cVS: return V;
+	case cVC: return !V;
+	case cHI: return C && !Z;
+	case cLS: return !C || Z;
+	case cGE: return N == V;
+	case cLT: return N != V;
+	case cGT: return !Z && N == V;
+	case cLE: return Z || N != V;
+	default: return true;
+	}
+}
+
+/*
+ * 1 if the instruction is ADD/SUB bReg, bReg, #imm (step stored in *lpStep),
+ * -1 if it modifies bReg in any other way, 0 if bReg is left alone
+ */
+static int InductionUpdate(const insn_t &stInstruction, unsigned char bReg, int *lpStep) {
+	switch (stInstruction.itype) {
+	case ARM_cmp:
+	case ARM_cmn:
+	case ARM_tst:
+	case ARM_teq:
+	case ARM_b:
+	case ARM_bx:
+	case ARM_cbz:
+	case ARM_cbnz:
+	case ARM_nop:
+	case ARM_push:
+	case ARM_ret:
+		return 0;
+	case ARM_str:
+	case ARM_ldr:
+	case ARM_ldrpc:
+		if (stInstruction.itype != ARM_str && stInstruction.ops[0].reg == bReg) {
+			return -1;
+		}
+		if (stInstruction.ops[1].reg == bReg && (stInstruction.auxpref & (aux_wback | aux_postidx))) {
+			return -1;
+		}
+		return 0;
+	case ARM_strd:
+	case ARM_ldrd:
+		if (stInstruction.itype == ARM_ldrd && (stInstruction.ops[0].reg == bReg || stInstruction.ops[1].reg == bReg)) {
+			return -1;
+		}
+		if (stInstruction.ops[2].reg == bReg && (stInstruction.auxpref & (aux_wback | aux_postidx))) {
+			return -1;
+		}
+		return 0;
+	case ARM_stm:
+		return (stInstruction.ops[0].reg == bReg && (stInstruction.auxpref & aux_wbackldm)) ? -1 : 0;
+	case ARM_pop:
+		return (stInstruction.ops[0].specval & (1 << bReg)) ? -1 : 0;
+	case ARM_ldm:
+		if (stInstruction.ops[1].specval & (1 << bReg)) {
+			return -1;
+		}
+		return (stInstruction.ops[0].reg == bReg && (stInstruction.auxpref & aux_wbackldm)) ? -1 : 0;
+	case ARM_bl:
+	case ARM_blx1:
+	case ARM_blx2:
+		/* caller-saved registers are clobbered */
+		return (bReg <= 3 || bReg == 12 || bReg == 14) ? -1 : 0;
+	case ARM_add:
+	case ARM_sub:
+		if (stInstruction.ops[0].type != o_reg || stInstruction.ops[0].reg != bReg) {
+			return 0;
+		}
+		if (stInstruction.segpref != cAL) {
+			return -1;
+		}
+		if (stInstruction.ops[2].type == o_void && stInstruction.ops[1].type == o_imm) {
+			*lpStep = (int)stInstruction.ops[1].value;
+		} else if (stInstruction.ops[1].type == o_reg && stInstruction.ops[1].reg == bReg && stInstruction.ops[2].type == o_imm) {
+			*lpStep = (int)stInstruction.ops[2].value;
+		} else {
+			return -1;
+		}
+		if (stInstruction.itype == ARM_sub) {
+			*lpStep = -*lpStep;
+		}
+		return 1;
+	default:
+		return (stInstruction.ops[0].type == o_reg && stInstruction.ops[0].reg == bReg) ? -1 : 0;
+	}
+}
+
+/* index into stLoop.aBody of the block holding lpAddress, -1 if none */
+static int LoopBlock(const loop_exit_t &stLoop, unsigned long lpAddress) {
+	size_t i;
+
+	for (i = 0; i < stLoop.aBody.size(); i++) {
+		if (lpAddress >= stLoop.aBody[i].first && lpAddress < stLoop.aBody[i].second) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+/* whether block dwTo can follow block dwFrom within one iteration, that is without passing the header again */
+static bool LoopReaches(const loop_exit_t &stLoop, int dwFrom, int dwTo) {
+	int dwHeader = LoopBlock(stLoop, stLoop.lpHeader);
+	std::vector<char> aSeen(stLoop.aBody.size(), 0);
+	std::vector<int> aWork(1, dwFrom);
+
+	aSeen[dwFrom] = 1;
+	while (!aWork.empty()) {
+		int dwCurrent = aWork.back();
+		aWork.pop_back();
+		if (dwCurrent == dwTo) {
+			return true;
+		}
+		for (int dwSucc : stLoop.aBodySucc[dwCurrent]) {
+			if (dwSucc != dwHeader && !aSeen[dwSucc]) {
+				aSeen[dwSucc] = 1;
+				aWork.push_back(dwSucc);
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * derive the trip count of a counted loop:
+ *  MOV Rn, #init ; preheader
+ *  ...
+ *  ADD/SUB Rn, Rn, #step ; exactly one update in the loop body
+ *  CMP Rn, #bound / SUBS Rn, Rn, #step / CBZ Rn ; feeds the exiting branch
+ */
+bool ArmImpl::SummarizeLoop(loop_exit_t &stLoop) {
+	insn_t stInstruction;
+	std::vector<std::pair<unsigned long, unsigned long>>::iterator it;
+	unsigned long lpAddress, lpBlockStart = 0, lpCompare = 0, lpIncrement = 0;
+	unsigned int dwValue = 0, dwBound = 0, i;
+	unsigned char bReg = 0;
+	char cCondition;
+	bool bAdd = false, bInitialized = false, bIncrementFirst;
+	int dwStep = 0, dwTemp, dwSize, dwBlock, dwIncrementBlock, dwCompareBlock;
+
+	dwBlock = LoopBlock(stLoop, stLoop.lpBranch);
+	if (dwBlock == -1) {
+		return false;
+	}
+	lpBlockStart = stLoop.aBody[dwBlock].first;
+
+	API_LOCK();
+	if (decode_insn(&stInstruction, stLoop.lpBranch) <= 0) {
+		goto _fail;
+	}
+	cCondition = stInstruction.segpref;
+	if (stInstruction.itype == ARM_cbz || stInstruction.itype == ARM_cbnz) {
+		bReg = (unsigned char)stInstruction.ops[0].reg;
+		cCondition = stInstruction.itype == ARM_cbz ? cEQ : cNE;
+		lpCompare = stLoop.lpBranch;
+	} else if (stInstruction.itype == ARM_b && cCondition >= cEQ && cCondition < cAL) {
+		/* find the instruction setting the flags, within the block of the branch */
+		for (lpAddress = stLoop.lpBranch, i = 0; i < 16 && lpCompare == 0; i++) {
+			lpAddress = prev_head(lpAddress, lpBlockStart);
+			if (lpAddress == BADADDR || decode_insn(&stInstruction, lpAddress) <= 0) {
+				goto _fail;
+			}
+			if (stInstruction.itype == ARM_cmp || stInstruction.itype == ARM_cmn) {
+				if (stInstruction.ops[0].type != o_reg || stInstruction.ops[1].type != o_imm) {
+					goto _fail;
+				}
+				bReg = (unsigned char)stInstruction.ops[0].reg;
+				dwBound = (unsigned int)stInstruction.ops[1].value;
+				bAdd = stInstruction.itype == ARM_cmn;
+				lpCompare = lpAddress;
+			} else if (stInstruction.auxpref & aux_cond) {
+				/* SUBS/ADDS Rn, Rn, #imm sets the flags of Rn -/+ imm */
+				if (stInstruction.ops[0].type != o_reg || InductionUpdate(stInstruction, (unsigned char)stInstruction.ops[0].reg, &dwTemp) != 1) {
+					goto _fail;
+				}
+				bReg = (unsigned char)stInstruction.ops[0].reg;
+				dwBound = (unsigned int)(dwTemp < 0 ? -dwTemp : dwTemp);
+				bAdd = stInstruction.itype == ARM_add;
+				lpCompare = lpAddress;
+			} else if (stInstruction.itype == ARM_tst || stInstruction.itype == ARM_teq) {
+				goto _fail;
+			}
+		}
+		if (lpCompare == 0) {
+			goto _fail;
+		}
+	} else {
+		goto _fail;
+	}
+
+	/* the induction register must be updated exactly once per iteration */
+	for (it = stLoop.aBody.begin(); it != stLoop.aBody.end(); it++) {
+		for (lpAddress = it->first; lpAddress < it->second; lpAddress += dwSize) {
+			if ((dwSize = decode_insn(&stInstruction, lpAddress)) <= 0) {
+				goto _fail;
+			}
+			switch (InductionUpdate(stInstruction, bReg, &dwTemp)) {
+			case -1:
+				goto _fail;
+			case 1:
+				if (lpIncrement != 0) {
+					goto _fail;
+				}
+				lpIncrement = lpAddress;
+				dwStep = dwTemp;
+				break;
+			}
+		}
+	}
+	if (lpIncrement == 0 || dwStep == 0) {
+		goto _fail;
+	}
+
+	/* does an iteration, entered at the header, reach the update or the compare first */
+	dwIncrementBlock = LoopBlock(stLoop, lpIncrement);
+	dwCompareBlock = LoopBlock(stLoop, lpCompare);
+	if (dwIncrementBlock == dwCompareBlock) {
+		/* straight line code */
+		bIncrementFirst = lpIncrement < lpCompare;
+	} else {
+		bIncrementFirst = LoopReaches(stLoop, dwIncrementBlock, dwCompareBlock);
+		if (bIncrementFirst == LoopReaches(stLoop, dwCompareBlock, dwIncrementBlock)) {
+			/* both orders (or neither) are possible */
+			goto _fail;
+		}
+	}
+
+	/* initial value is set by the last write to the register before entering the loop */
+	if (stLoop.stPreheader.second == 0) {
+		goto _fail;
+	}
+	for (lpAddress = stLoop.stPreheader.second, i = 0; i < 32 && !bInitialized; i++) {
+		lpAddress = prev_head(lpAddress, stLoop.stPreheader.first);
+		if (lpAddress == BADADDR || decode_insn(&stInstruction, lpAddress) <= 0) {
+			goto _fail;
+		}
+		if (
+			(stInstruction.itype == ARM_mov || stInstruction.itype == ARM_movl) &&
+			stInstruction.ops[0].type == o_reg && stInstruction.ops[0].reg == bReg &&
+			stInstruction.ops[1].type == o_imm && stInstruction.segpref == cAL
+		) {
+			dwValue = (unsigned int)stInstruction.ops[1].value;
+			bInitialized = true;
+		} else if (InductionUpdate(stInstruction, bReg, &dwTemp) != 0) {
+			goto _fail;
+		}
+	}
+	API_UNLOCK();
+
+	if (!bInitialized) {
+		return false;
+	}
+
+	for (i = 1; i <= 0x10000; i++) {
+		/* SUBS/ADDS compare the value from before their own update */
+		unsigned int dwCompared = bIncrementFirst ? dwValue + dwStep : dwValue;
+		bool bTaken = EvaluateCondition(cCondition, dwCompared, dwBound, bAdd);
+		dwValue += dwStep;
+		if (bTaken != stLoop.bStayOnTrue) {
+			stLoop.dwTripCount = i;
+			return true;
+		}
+	}
+	return false;
+
+_fail:
+	API_UNLOCK();
+	return false;
+}
+
 Processor ArmImpl::Migrate(DFGraph oGraph) {
 	Arm lpFork(Arm::create(*this));
 	std::vector<DFGNode>::iterator it;
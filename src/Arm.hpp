@@ -51,6 +51,7 @@ public:
 	void initialize(CodeBroker &oBuilder);
 	processor_status_t instruction(CodeBroker &oBuilder, unsigned long *lpNextAddress, unsigned long lpAddress);
 	bool ShouldClean(DFGNode &oNode);
+	bool SummarizeLoop(loop_exit_t &stLoop);
 
 protected:
 	virtual Processor Migrate(DFGraph oGraph);
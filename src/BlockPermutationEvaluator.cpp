@@ -40,7 +40,7 @@ bool BlockPermutationEvaluatorImpl::Evaluate(AbstractEvaluationResult * lpOutput
 	SpecMap::iterator itSpec;
 	std::unordered_map<DFGNode, std::list<NodeTriplet>> aCandidates;
 	std::unordered_map<DFGNode, std::list<NodeTriplet>>::iterator itCand;
-	this->oEvalCache = SparseMatrix::create();
+	aEvalCache.clear();
 
 	dwStartTime = GetTickCount();
 
@@ -106,6 +106,9 @@ _continue_one:
 
 	for (itCand = aCandidates.begin(); itCand != aCandidates.end(); itCand++) {
 		BreadthFirstSearch(&itCand->second, itCand->first);
+		if (Cancelled()) {
+			goto _evaluation_error;
+		}
 		if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime) {
 _time_exceeded:
 			wc_debug("[-] max evaluation time exceeded for function %s (%s), signature : Block Permutation\n",
@@ -140,13 +143,16 @@ _time_exceeded:
 						true,
 						((double)(dwEndTime - dwStartTime) / 1000)
 					);
-					oEvalCache = nullptr;
+					aEvalCache.clear();
 					return true;
 				}
 
 				if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime) {
 					goto _time_exceeded;
 				}
+				if (Cancelled()) {
+					goto _evaluation_error;
+				}
 			}
 		}
 	}
@@ -162,10 +168,10 @@ _evaluation_error:
 	*lpOutput = BlockPermutationEvaluationResult::create(
 		BlockPermutationEvaluator::typecast(this),
 		oCodeGraph,
-		EVALUATION_RESULT_NO_MATCH_FOUND,
+		Cancelled() ? EVALUATION_RESULT_CANCELLED : EVALUATION_RESULT_NO_MATCH_FOUND,
 		nullptr
 	)->toAbstract();
-	oEvalCache = nullptr;
+	aEvalCache.clear();
 	return false;
 }
 
@@ -188,6 +194,9 @@ void BlockPermutationEvaluatorImpl::BreadthFirstSearch(std::list<NodeTriplet> *l
 	}
 
 	while (aQueue.size()) {
+		if (Cancelled()) {
+			return;
+		}
 		BFSPath oCurrent = aQueue.front();
 		aQueue.pop_front();
 		//aFlaggedNodes.insert(std::pair<DFGNode, char>(oCurrent->oNode, 0));
@@ -237,6 +246,9 @@ void BlockPermutationEvaluatorImpl::BreadthFirstSearch(std::list<NodeTriplet> *l
 }
 
 bool BlockPermutationEvaluatorImpl::BFSMapPath(BFSPath oPath, DFGNode oSource, DFGNode oTarget) {
+	std::unordered_map<unsigned long long, assignment_t>::iterator itCache;
+	unsigned long long qwCacheKey;
+
 	if (oPath == nullptr) {
 		return false;
 	} else if (oPath->oParent == nullptr) {
@@ -247,15 +259,17 @@ bool BlockPermutationEvaluatorImpl::BFSMapPath(BFSPath oPath, DFGNode oSource, D
 		/* same node, no need to test compatibility */
 		goto _skip;
 	}
-	assignment_t eCacheVal = oEvalCache->GetAssignment(oPath->oNode->dwNodeId, oSource->dwNodeId);
+	qwCacheKey = ((unsigned long long)oPath->oNode->dwNodeId << 32) | oSource->dwNodeId;
+	itCache = aEvalCache.find(qwCacheKey);
 	/* consult cache */
-	if (eCacheVal == ASSIGNMENT_INVALID) {
-		goto _not_found;
-	} else if (eCacheVal == ASSIGNMENT_VALID) {
+	if (itCache != aEvalCache.end()) {
+		if (itCache->second == ASSIGNMENT_INVALID) {
+			return false;
+		}
 		goto _skip;
 	}
 
-	if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime) {
+	if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime || Cancelled()) {
 		return false;
 	}
 
@@ -306,11 +320,11 @@ bool BlockPermutationEvaluatorImpl::BFSMapPath(BFSPath oPath, DFGNode oSource, D
 		 //fall through
 	} else {
 _not_found:
-		oEvalCache->Assign(oPath->oNode->dwNodeId, oSource->dwNodeId, ASSIGNMENT_INVALID);
+		aEvalCache[qwCacheKey] = ASSIGNMENT_INVALID;
 		return false;
 	}
 
-	oEvalCache->Assign(oPath->oNode->dwNodeId, oSource->dwNodeId, ASSIGNMENT_VALID);
+	aEvalCache[qwCacheKey] = ASSIGNMENT_VALID;
 
 _skip:
 	if (oPath->eDirection == PATH_DIRECTION_DOWN) {
@@ -46,12 +46,18 @@ public:
 	inline BlockPermutationEvaluatorImpl() { }
 
 	bool Evaluate(AbstractEvaluationResult *lpOutput);
+	inline std::string Identifier() { return "Sequential Block Permutation"; }
+	inline task_kind_t Kind() { return TASK_KIND_BLOCK_PERMUTATION; }
 
 private:
 	void BreadthFirstSearch(std::list<NodeTriplet> *lpOutput, DFGNode oNode1);
 	bool BFSMapPath(BFSPath oPath, DFGNode oSource, DFGNode oTarget);
 	void SpecString(std::string *lpOutput, unsigned int *lpConstant, DFGNode oLoad);
-	SparseMatrix oEvalCache; // borrowed from SignatureEvaluator, used to signifying node compatibility
+	/*
+	 * node compatibility, keyed by (path node id << 32 | source node id).
+	 * code nodes against code nodes : too sparse for SparseMatrix' dense rows
+	 */
+	std::unordered_map<unsigned long long, assignment_t> aEvalCache;
 	unsigned int dwStartTime;
 };
 
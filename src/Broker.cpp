@@ -13,8 +13,10 @@
 #include "Predicate.hpp"
 #include "Backlog.hpp"
 #include "PathOracle.hpp"
+#include "FunctionContext.hpp"
 #include "ThreadPool.hpp"
 #include "SignatureParser.hpp"
+#include "MatchPlan.hpp"
 #include "ThreadPool.hpp"
 
 #define BAD_ZERO_VALUE 0xfeedface
@@ -745,12 +747,15 @@ CodeBrokerImpl::CodeBrokerImpl(
 	Processor oProcessor,
 	ThreadPool oThreadPool,
 	unsigned long lpStartAddress,
-	PathOracle oPathOracle
+	PathOracle oPathOracle,
+	FunctionContext oFunctionContext
 ) :
 	ThreadTaskResultImpl(THREAD_RESULT_TYPE_CODE_GRAPH),
 	BrokerImpl(),
 	oProcessor(oProcessor),
 	oPathOracle(oPathOracle),
+	oFunctionContext(oFunctionContext),
+	oToken(CancellationToken::create()),
 	oStatePredicate(Predicate::create()),
 	oBacklog(BacklogDb::create()),
 	oThreadPool(oThreadPool),
@@ -759,7 +764,11 @@ CodeBrokerImpl::CodeBrokerImpl(
 	dwMaxConsecutiveNoopInstructions(oPathOracle->MaxConsecutiveNoopInstructions()),
 	dwMaxConstructionTime(oPathOracle->MaxConstructionTime()),
 	dwMaxConditions(oPathOracle->MaxConditions()),
-	dwNumConditions(0)
+	dwNumConditions(0),
+	dwForkDepth(0),
+	dwNumInstructions(0),
+	dwNextCheckpoint(oPathOracle->IncrementalEvaluationInterval()),
+	bCheckpoint(false)
 {
 	qstring szFunctionName;
 	API_LOCK();
@@ -782,9 +791,19 @@ bool CodeBrokerImpl::ScheduleBuild(
 	PathOracle oPathOracle,
 	bool bOnlyIfResourceAvailable
 ) {
-	CodeBroker oBuilder(CodeBroker::create(oProcessor, oThreadPool, lpAddress, oPathOracle == nullptr ? PathOracle::create(lpAddress) : oPathOracle));
+	CodeBroker oBuilder(CodeBroker::create(
+		oProcessor,
+		oThreadPool,
+		lpAddress,
+		oPathOracle == nullptr ? PathOracle::create(lpAddress) : oPathOracle,
+		FunctionContext::create(lpAddress)
+	));
 	if (bOnlyIfResourceAvailable) {
-		return oThreadPool->ScheduleIfResourceAvailable(oBuilder->toThreadTask(), (void*)lpAddress);
+		return oThreadPool->ScheduleIfResourceAvailable(
+			oBuilder->toThreadTask(),
+			(void*)lpAddress,
+			DFGraphImpl::LiveBytes() >= PathOracleImpl::MaxMemoryUsage()
+		);
 	}
 	oThreadPool->Schedule(oBuilder->toThreadTask(), (void*)lpAddress);
 	return true;
@@ -812,7 +831,13 @@ graph_process_t CodeBrokerImpl::IntroduceCondition(Condition &oCondition, unsign
 			wc_debug("[*] max number of conditions exceeded @ 0x%lx\n", lpCurrentAddress);
 			return GRAPH_PROCESS_INTERNAL_ERROR;
 		}
-		fork_policy_t eShouldFork = oPathOracle->ShouldFork(oBacklog, lpCurrentAddress);
+		/* a fork would double this path's memory, ask before the oracle spends the function's forks */
+		fork_policy_t eShouldFork = oPathOracle->ShouldFork(
+			oBacklog,
+			lpCurrentAddress,
+			oProcessor,
+			DFGraphImpl::LiveBytes() + LiveBytes() < PathOracleImpl::MaxMemoryUsage()
+		);
 		wc_debug("[*] path oracle says %s at conditional instruction @ 0x%lx\n",
 			(eShouldFork == FORK_POLICY_TAKE_FALSE) ? "TAKE_FALSE" :
 			((eShouldFork == FORK_POLICY_TAKE_TRUE) ? "TAKE_TRUE" : "TAKE_BOTH"),
@@ -879,6 +904,18 @@ _true_case:
 	return GRAPH_PROCESS_INTERNAL_ERROR;
 }
 
+unsigned long CodeBrokerImpl::TaskGroup() {
+	return oPathOracle->lpFunctionAddress;
+}
+
+double CodeBrokerImpl::Priority() {
+	return oPathOracle->PathPriority(dwForkDepth, dwNumInstructions, oGraph);
+}
+
+size_t CodeBrokerImpl::LiveBytes() {
+	return oGraph->qwLiveBytes;
+}
+
 int CodeBrokerImpl::MaxCallDepth() {
 	return oPathOracle->MaxCallDepth();
 }
@@ -931,12 +968,21 @@ void CodeBrokerImpl::Build_Impl(unsigned long lpAddress) {
 			dwNumIterationsWithoutProgress = 0;
 		}
 		dwLastNumNodes = oGraph->size();
+		if (dwNextCheckpoint != 0 && oGraph->size() >= dwNextCheckpoint) {
+			YieldCheckpoint();
+			dwNextCheckpoint *= 2;
+		}
 		if ((GetTickCount() - dwStartTime) > dwMaxConstructionTime) {
 			wc_debug("[-] max construction time exceeded for function %s (%s)\n", szFunctionName.c_str(), oStatePredicate->expression(2).c_str());
 			goto _analysis_error;
 		}
+		if (oFunctionContext->oToken->IsCancelled()) {
+			wc_debug("[*] construction cancelled for function %s (%s)\n", szFunctionName.c_str(), oStatePredicate->expression(2).c_str());
+			goto _analysis_error;
+		}
 		unsigned long lpNextAddress;
 		lpCurrentAddress = lpAddress;
+		dwNumInstructions++;
 		processor_status_t eStatus = oProcessor->instruction(CodeBroker::typecast(this), &lpNextAddress, lpAddress);
 		if (eStatus == PROCESSOR_STATUS_OK) {
 			lpAddress = lpNextAddress;
@@ -948,6 +994,8 @@ void CodeBrokerImpl::Build_Impl(unsigned long lpAddress) {
 	wc_debug("[*] size of graph : %llu\n", oGraph->size());
 	Cleanup();
 	wc_debug("[*] size of graph after cleanup : %llu\n", oGraph->size());
+	/* the graph is final now, index it for the evaluators */
+	BuildMatchGraph();
 	DWORD dwEndTime = GetTickCount();
 	wc_debug("[*] total construction time : %fs\n", ((double)(dwEndTime - dwStartTime) / 1000));
 
@@ -959,6 +1007,40 @@ _analysis_error:
 	oThreadPool->YieldResult(ThreadTaskResult::typecast(EmptyAnalysisResult::create()));
 }
 
+/*
+ * incremental evaluation : the graph built so far is evaluated like a finished path.
+ * it isn't cleaned up, values still held in registers would be dropped.
+ * a match cancels the function, this path included
+ */
+void CodeBrokerImpl::YieldCheckpoint() {
+	Broker oFork = fork();
+	if (oFork == nullptr) {
+		return;
+	}
+	CodeBroker oSnapshot = oFork->toCodeGraph();
+	oSnapshot->bCheckpoint = true;
+	oSnapshot->dwNextCheckpoint = 0;
+	oSnapshot->BuildMatchGraph();
+	wc_debug("[*] checkpoint of %s (%s) at %llu nodes\n", szFunctionName.c_str(), oStatePredicate->expression(2).c_str(), oGraph->size());
+
+	ThreadTaskResult oResult = ThreadTaskResult::typecast(oSnapshot.lpNode);
+	oThreadPool->YieldResult(oResult);
+}
+
+void CodeBrokerImpl::BuildMatchGraph() {
+	bool aKeepType[NODE_TYPE_MAX];
+
+	oGraph->BuildTypeIndex();
+	oMatchGraph = nullptr;
+	if (MatchPlanImpl::KeepTypes(aKeepType)) {
+		oMatchGraph = oGraph->Reduce(aKeepType);
+	}
+	if (oMatchGraph != nullptr) {
+		oMatchGraph->BuildTypeIndex();
+		wc_debug("[*] size of graph reduced for the signatures : %llu\n", oMatchGraph->size());
+	}
+}
+
 Broker CodeBrokerImpl::fork() {
 	std::unordered_map<unsigned int, DFGNode>::iterator it;
 
@@ -977,6 +1059,10 @@ Broker CodeBrokerImpl::fork() {
 	oFork->oStatePredicate = oStatePredicate->Migrate(oFork->oGraph);
 	/* fork the backlog */
 	oFork->oBacklog = oBacklog->fork();
+	oFork->dwForkDepth++;
+	/* the fork yields a graph of its own */
+	oFork->oToken = CancellationToken::create();
+	oFork->oMatchGraph = nullptr;
 	//oFork->oPathOracle = PathOracle::create(*oFork->oPathOracle);
 
 	for (it = oFork->aMemoryMap.begin(); it != oFork->aMemoryMap.end(); it++) {
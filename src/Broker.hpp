@@ -6,6 +6,8 @@
 #include "types.hpp"
 #include "ThreadPool.hpp"
 #include "DFGNode.hpp"
+#include "FunctionContext.hpp"
+#include "MatchPlan.hpp"
 
 #define DOT_FLAG_CARRY 1
 #define DOT_FLAG_OVERFLOW 2
@@ -120,21 +122,42 @@ public:
 	Broker fork();
 	int MaxCallDepth();
 	bool ShouldCleanNode(DFGNode &oNode);
+	/* ThreadTask scheduling : paths are grouped per function */
+	inline task_lane_t Lane() { return TASK_LANE_CONSTRUCTION; }
+	inline task_kind_t Kind() { return TASK_KIND_CONSTRUCTION; }
+	unsigned long TaskGroup();
+	double Priority();
+	/* estimated memory held by this path */
+	size_t LiveBytes();
+	/* token cancelling the evaluation of this graph */
+	inline CancellationToken Token() { return oToken; }
+	inline FunctionContext Context() { return oFunctionContext; }
+	/* snapshot of a path still under construction, reported only if it matches */
+	inline bool IsCheckpoint() { return bCheckpoint; }
+	/* what the signature evaluators run on : the graph without the nodes no loaded signature can use */
+	inline DFGraph MatchGraph() { return oMatchGraph != nullptr ? oMatchGraph : oGraph; }
+	/* once all evaluations are done, only the full graph is kept for display */
+	inline void DropMatchGraph() { oMatchGraph = nullptr; }
 
 protected:
 	CodeBrokerImpl(
 		Processor oProcessor,
 		ThreadPool oThreadpool,
 		unsigned long lpStartAddress,
-		PathOracle oPathOracle
+		PathOracle oPathOracle,
+		FunctionContext oFunctionContext
 	);
 	/* ThreadTask */
 	unsigned long Execute(void *lpPrivate) { Build_Impl((unsigned long)lpPrivate); return 0; }
 	void Build_Impl(unsigned long lpAddress);
+	void YieldCheckpoint();
+	void BuildMatchGraph();
 	Predicate oStatePredicate;
 	BacklogDb oBacklog;
 	Processor oProcessor;
 	PathOracle oPathOracle;
+	FunctionContext oFunctionContext;
+	CancellationToken oToken;
 	ThreadPool oThreadPool;
 	unsigned long lpCurrentAddress;
 	unsigned long lpStartAddress;
@@ -144,6 +167,11 @@ protected:
 	int dwMaxConstructionTime;
 	int dwMaxConditions;
 	int dwNumConditions;
+	unsigned int dwForkDepth;
+	unsigned int dwNumInstructions;
+	unsigned int dwNextCheckpoint; // graph size of the next checkpoint, 0 if none
+	bool bCheckpoint;
+	DFGraph oMatchGraph; // read-only, nullptr if nothing could be dropped
 
 friend class DFGPlugin;
 friend CodeBroker;
@@ -167,4 +195,6 @@ public:
 	std::string szIdentifier;
 	std::string szVariant;
 	int dwNumOpaqueRefs;
+	/* compiled once all signatures are loaded, see ControlDialog::ConstructSignatures */
+	MatchPlan oMatchPlan;
 };
\ No newline at end of file
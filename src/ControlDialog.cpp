@@ -25,6 +25,8 @@
 #include "ThreadPool.hpp"
 #include "ControlDialog.hpp"
 #include "PathOracle.hpp"
+#include "FunctionContext.hpp"
+#include "MatchPlan.hpp"
 #include "SlidingStackedWidget.hpp"
 #include "AnalysisResult.hpp"
 #include "BlockPermutationEvaluator.hpp"
@@ -36,6 +38,7 @@ void CoordinatorThread::run() {
 	std::unordered_map<Broker, AnalysisResult> aResultTracker;
 	std::unordered_map<Broker, AnalysisResult>::iterator itT;
 	DWORD dwStartTime = GetTickCount();
+	unsigned int dwPrefiltered = 0;
 	bool bScheduled;
 
 	wc_debug("[+] Analysis started\n");
@@ -52,6 +55,7 @@ void CoordinatorThread::run() {
 			AbstractEvaluationResult oEvaluationResult;
 			AnalysisResult oAnalysisResult;
 			std::list<SignatureDefinition>::iterator it;
+			SignatureDefinitionImpl::iterator itVariant;
 
 			switch (oResult->dwType) {
 			case THREAD_RESULT_TYPE_ANALYSIS_ERROR: {
@@ -59,9 +63,23 @@ void CoordinatorThread::run() {
 			}
 			case THREAD_RESULT_TYPE_CODE_GRAPH: {
 				oCodeGraph = (CodeBrokerImpl*)oResult.lpNode;
+				if (oCodeGraph->Context()->oToken->IsCancelled()) {
+					/* function is done already, no need to evaluate this path */
+					break;
+				}
 				oAnalysisResult = AnalysisResult::create(oCodeGraph->toGeneric());
 				wc_debug("[+] yielded a new code graph (%d nodes)\n", oCodeGraph->oGraph->size());
 				for (it = aSignatureList.begin(); it != aSignatureList.end(); it++) {
+					/* cheap necessary conditions first, no need to schedule what can't match */
+					for (itVariant = (*it)->begin(); itVariant != (*it)->end(); itVariant++) {
+						if ((*itVariant)->oMatchPlan == nullptr || (*itVariant)->oMatchPlan->MayMatch(oCodeGraph->MatchGraph())) {
+							break;
+						}
+					}
+					if (itVariant == (*it)->end()) {
+						dwPrefiltered++;
+						continue;
+					}
 					AbstractEvaluator oEvaluator = AbstractEvaluatorImpl::ScheduleEvaluate<SignatureEvaluator>(
 						oPool,
 						oCodeGraph->toGeneric(),
@@ -94,15 +112,48 @@ void CoordinatorThread::run() {
 					oAnalysisResult = itT->second;
 					oAnalysisResult->SetResult(oEvaluationResult);
 
+					if (oEvaluationResult->eStatus == EVALUATION_RESULT_MATCH_FOUND) {
+						FunctionContext oContext = oEvaluationResult->oCodeGraph->toCodeGraph()->Context();
+						oContext->aMatched.insert(std::pair<std::string, char>(oEvaluationResult->oEvaluator->Identifier(), 0));
+						bool bAllMatched = oContext->aMatched.size() == aSignatureList.size() + 1;
+
+						if (PathOracleImpl::CancelOnFirstMatch() || bAllMatched) {
+							/*
+							 * stop constructing the function's remaining paths,
+							 * and stop evaluating its other graphs (this one too if nothing is left to find)
+							 */
+							oContext->oToken->Cancel();
+							for (itT = aResultTracker.begin(); itT != aResultTracker.end(); itT++) {
+								CodeBroker oTracked = itT->second->oCodeGraph->toCodeGraph();
+								if (oTracked->Context() == oContext &&
+									(bAllMatched || itT->first != oEvaluationResult->oCodeGraph)
+								) {
+									oTracked->Token()->Cancel();
+								}
+							}
+						}
+					}
+
 					if (oAnalysisResult->AllResultsSet()) {
 _all_results_set:
-						aResultTracker.erase(oEvaluationResult->oCodeGraph);
-						emit ResultReady(oAnalysisResult);
+						aResultTracker.erase(oAnalysisResult->oCodeGraph);
+						/* only kept for display from here on */
+						oAnalysisResult->oCodeGraph->oGraph->Retire();
+						oAnalysisResult->oCodeGraph->toCodeGraph()->DropMatchGraph();
+						if (!oAnalysisResult->Cancelled() &&
+							(!oAnalysisResult->oCodeGraph->toCodeGraph()->IsCheckpoint() || oAnalysisResult->Matched())
+						) {
+							/* checkpoints are only worth reporting when they match */
+							emit ResultReady(oAnalysisResult);
+						}
 					}
 				}
 				break;
 			}
 			ScheduleNextFunction(oPool);
+		} else if (ScheduleNextFunction(oPool, true)) {
+			/* the pool went idle while over budget, functions are admitted one at a time */
+			continue;
 		} else {
 			wc_debug("[-] end of result report\n");
 			break;
@@ -110,14 +161,20 @@ _all_results_set:
 	}
 
 	wc_debug("[+] Analysis finished. Total running time was %fs\n", (double)(GetTickCount() - dwStartTime) / 1000);
+	wc_debug("[*] %u signature evaluations ruled out by the prefilter\n", dwPrefiltered);
+	wc_debug("[*] memory high-water mark : %lu KB in all graphs, %lu KB in a single graph\n",
+		(unsigned long)(DFGraphImpl::PeakLiveBytes() >> 10),
+		(unsigned long)(DFGraphImpl::PeakGraphBytes() >> 10)
+	);
+	oPool->DumpStatistics();
 	emit CoordinatorFinished();
 }
 
-bool CoordinatorThread::ScheduleNextFunction(ThreadPool &oPool) {
+bool CoordinatorThread::ScheduleNextFunction(ThreadPool &oPool, bool bForce) {
 	std::list<unsigned long>::iterator itF = aFunctionList.begin();
 	if (itF != aFunctionList.end()) {
 		Processor oProcessor(Processor::typecast(Arm::create()));
-		bool bScheduled = CodeBrokerImpl::ScheduleBuild(oProcessor, oPool, *itF, nullptr, true);
+		bool bScheduled = CodeBrokerImpl::ScheduleBuild(oProcessor, oPool, *itF, nullptr, !bForce);
 		if (bScheduled) {
 			aFunctionList.erase(itF);
 			emit NextFunction();
@@ -387,6 +444,15 @@ void ControlDialog::ConstructSignatures() {
 				SignatureParser oParser(SignatureParser::create());
 				SignatureDefinition oSignatureDefinition;
 				if (oParser->Parse(&oSignatureDefinition, szSpecification, stFindData.cFileName) == PARSER_STATUS_OK) {
+					SignatureDefinitionImpl::iterator itV;
+					for (itV = oSignatureDefinition->begin(); itV != oSignatureDefinition->end(); itV++) {
+						(*itV)->oMatchPlan = MatchPlan::create(*itV);
+						/* signatures are never built on, they don't count against the memory budget */
+						(*itV)->oGraph->Retire();
+						if ((*itV)->oMatchPlan->oCoreGraph != nullptr) {
+							(*itV)->oMatchPlan->oCoreGraph->oGraph->Retire();
+						}
+					}
 					wc_debug("[+] Successfully parsed signature (id=%s)\n", oSignatureDefinition->szIdentifier.c_str());
 					aSignatureList.push_back(oSignatureDefinition);
 				}
@@ -394,4 +460,5 @@ void ControlDialog::ConstructSignatures() {
 		} while (::FindNextFile(hFind, &stFindData));
 		::FindClose(hFind);
 	}
+	MatchPlanImpl::SetLoaded(aSignatureList);
 }
\ No newline at end of file
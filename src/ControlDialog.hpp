@@ -29,7 +29,8 @@ public:
 	void run();
 
 private:
-	bool ScheduleNextFunction(ThreadPool &oPool);
+	/* bForce : admit the function even when over the memory budget */
+	bool ScheduleNextFunction(ThreadPool &oPool, bool bForce = false);
 
 signals:
 	void ResultReady(AnalysisResult oResult);
@@ -22,7 +22,8 @@ typedef enum {
 	NODE_TYPE_ROTATE,
 	NODE_TYPE_CARRY,
 	NODE_TYPE_OVERFLOW,
-	NODE_TYPE_OPAQUE
+	NODE_TYPE_OPAQUE,
+	NODE_TYPE_MAX
 } node_type_t;
 
 #define NODE_IS_CONSTANT(x) ((x)->eNodeType == NODE_TYPE_CONSTANT)
@@ -39,6 +40,10 @@ typedef enum {
 #define NODE_IS_ROTATE(x) ((x)->eNodeType == NODE_TYPE_ROTATE)
 #define NODE_IS_CARRY(x) ((x)->eNodeType == NODE_TYPE_CARRY)
 #define NODE_IS_OPAQUE(x) ((x)->eNodeType == NODE_TYPE_OPAQUE)
+/* inputs of these node types match by position, not as a set */
+#define NODE_HAS_ORDERED_INPUTS(x) (NODE_IS_STORE(x) || NODE_IS_LOAD(x) || NODE_IS_SHIFT(x) || NODE_IS_ROTATE(x))
+/* number of inputs a matching node must at least have */
+#define NODE_ARITY(x) (NODE_HAS_ORDERED_INPUTS(x) ? (x)->aInputNodes.size() : (x)->aInputNodesUnique.size())
 
 #define CACHED(method) \
 	virtual std::string method ## _impl() const = 0; \
@@ -57,7 +62,7 @@ public:
 	node_type_t eNodeType;
 	unsigned int dwNodeId;
 
-	inline DFGNodeImpl() : eNodeType(NODE_TYPE_UNKNOWN), dwNodeId(0) { }
+	inline DFGNodeImpl() : eNodeType(NODE_TYPE_UNKNOWN), dwNodeId(0), dwFootprint(0) { }
 	virtual ~DFGNodeImpl() { }
 //	CACHED(mnemonic)
 //	CACHED(idx)
@@ -89,10 +94,12 @@ public:
 	inline DFGOpaque toOpaque() { return DFGOpaque::typecast(this); };
 
 protected:
-	inline DFGNodeImpl(node_type_t eNodeType): eNodeType(eNodeType), dwNodeId(0) { }
+	inline DFGNodeImpl(node_type_t eNodeType): eNodeType(eNodeType), dwNodeId(0), dwFootprint(0) { }
 	std::string GenericIdx(const char *szPrefix) const;
 	std::string GenericExpression(const char *szPrefix, const char *szSeparator, int dwMaxDepth) const;
 	virtual inline DFGNode copy() const = 0;
+	/* bytes charged to the owning graph when inserted */
+	unsigned int dwFootprint;
 
 friend class DFGraphImpl;
 friend class BrokerImpl;
@@ -1,12 +1,30 @@
 #include <idp.hpp>
+#include <cstring>
+#include <algorithm>
 
 #include "common.hpp"
 #include "DFGraph.hpp"
 #include "DFGNode.hpp"
 
-DFGraphImpl::DFGraphImpl(): dwNodeCounter(0) { }
+/*
+ * rough per-node footprint : the node object itself, its entries in both indices
+ * of the graph and its arcs. only meant to track trends, not exact usage
+ */
+#define DFG_NODE_BASE_BYTES 320
+#define DFG_ARC_BYTES 64
+
+std::atomic<size_t> DFGraphImpl::qwGlobalLiveBytes(0);
+std::atomic<size_t> DFGraphImpl::qwGlobalPeakBytes(0);
+std::atomic<size_t> DFGraphImpl::qwGraphPeakBytes(0);
+
+DFGraphImpl::DFGraphImpl(): dwNodeCounter(0), qwLiveBytes(0), bTypeIndexValid(false), bRetired(false) {
+	memset(aNodeTypeCount, 0, sizeof(aNodeTypeCount));
+}
 DFGraphImpl::~DFGraphImpl() {
 	iterator it;
+	if (!bRetired) {
+		qwGlobalLiveBytes -= qwLiveBytes;
+	}
 	for (it = begin(); it != end(); it++) {
 		it->second->aInputNodes.clear();
 		it->second->aOutputNodes.clear();
@@ -18,6 +36,9 @@ void DFGraphImpl::InsertNode(DFGNode oNode) {
 	std::list<DFGNode>::iterator itUp;
 	std::unordered_map<unsigned int, DFGNode>::iterator itDown;
 	oNode->dwNodeId = dwNodeCounter++;
+	aNodeTypeCount[oNode->eNodeType]++;
+	Account(oNode, true);
+	bTypeIndexValid = false;
 	aIdMap.insert(std::pair<unsigned int, DFGNode>(oNode->dwNodeId, oNode));
 	insert(std::pair<std::string, DFGNode>(oNode->idx(), oNode));
 
@@ -50,6 +71,9 @@ void DFGraphImpl::RemoveNode(DFGNode oNode) {
 
 	oNode->aOutputNodes.clear();
 	oNode->aInputNodesUnique.clear();
+	aNodeTypeCount[oNode->eNodeType]--;
+	Account(oNode, false);
+	bTypeIndexValid = false;
 	aIdMap.erase(oNode->dwNodeId);
 	erase(oNode->idx());
 }
@@ -83,6 +107,8 @@ DFGNode DFGraphImpl::CopyNode(const DFGNode &oNode, unsigned int dwStackSize) {
 		}
 	}
 
+	aNodeTypeCount[oCopy->eNodeType]++;
+	Account(oCopy, true);
 	aIdMap.insert(std::pair<unsigned int, DFGNode>(oCopy->dwNodeId, oCopy));
 	insert(std::pair<std::string, DFGNode>(oCopy->idx(), oCopy));
 	//if (oCopy->idx() != oNode->idx()) {
@@ -91,6 +117,212 @@ DFGNode DFGraphImpl::CopyNode(const DFGNode &oNode, unsigned int dwStackSize) {
 	return oCopy;
 }
 
+void DFGraphImpl::Account(DFGNode oNode, bool bInsert) {
+	size_t qwBytes, qwPeak, qwLive;
+
+	if (!bInsert) {
+		/* inputs may have been rewritten since, release exactly what was charged */
+		qwLiveBytes -= oNode->dwFootprint;
+		if (!bRetired) {
+			qwGlobalLiveBytes -= oNode->dwFootprint;
+		}
+		oNode->dwFootprint = 0;
+		return;
+	}
+	/* input arcs are counted twice, once for their output arc counterpart */
+	qwBytes = DFG_NODE_BASE_BYTES + 2 * oNode->idx().size() + 2 * DFG_ARC_BYTES * oNode->aInputNodes.size();
+	oNode->dwFootprint = (unsigned int)qwBytes;
+	qwLiveBytes += qwBytes;
+	if (bRetired) {
+		return;
+	}
+	qwLive = (qwGlobalLiveBytes += qwBytes);
+
+	qwPeak = qwGlobalPeakBytes.load(std::memory_order_relaxed);
+	while (qwLive > qwPeak && !qwGlobalPeakBytes.compare_exchange_weak(qwPeak, qwLive)) { }
+	qwPeak = qwGraphPeakBytes.load(std::memory_order_relaxed);
+	while (qwLiveBytes > qwPeak && !qwGraphPeakBytes.compare_exchange_weak(qwPeak, qwLiveBytes)) { }
+}
+
+void DFGraphImpl::Retire() {
+	if (!bRetired) {
+		bRetired = true;
+		qwGlobalLiveBytes -= qwLiveBytes;
+	}
+}
+
+void DFGraphImpl::BuildTypeIndex() {
+	std::unordered_map<unsigned int, DFGNode>::iterator it;
+	int i;
+
+	for (i = 0; i < NODE_TYPE_MAX; i++) {
+		aTypeIndex[i].clear();
+		aTypeIndex[i].reserve(aNodeTypeCount[i]);
+		aMaxArity[i] = 0;
+	}
+	aConstantIndex.clear();
+	aConstantAmounts.clear();
+	aFingerprint.assign(dwNodeCounter, node_fingerprint_t());
+
+	/* by id, so candidates are visited in creation order */
+	for (i = 0; i < (int)dwNodeCounter; i++) {
+		if ((it = aIdMap.find(i)) == aIdMap.end()) {
+			continue;
+		}
+		DFGNode oNode = it->second;
+		aTypeIndex[oNode->eNodeType].push_back(oNode);
+		if (NODE_IS_CONSTANT(oNode)) {
+			aConstantIndex[oNode->toConstant()->dwValue].push_back(oNode);
+		}
+		aFingerprint[i] = ComputeFingerprint(oNode);
+		if (NODE_ARITY(oNode) > aMaxArity[oNode->eNodeType]) {
+			aMaxArity[oNode->eNodeType] = (unsigned int)NODE_ARITY(oNode);
+		}
+		if ((NODE_IS_SHIFT(oNode) || NODE_IS_ROTATE(oNode)) &&
+			oNode->aInputNodes.size() == 2 && NODE_IS_CONSTANT(oNode->aInputNodes.back())
+		) {
+			aConstantAmounts[((unsigned long long)oNode->eNodeType << 32) | oNode->aInputNodes.back()->toConstant()->dwValue]++;
+		}
+	}
+	HashCones();
+	Components(aComponent, aComponentSize);
+	dwSmallestComponent = aComponentSize.empty() ? 0 : *std::min_element(aComponentSize.begin(), aComponentSize.end());
+	dwLargestComponent = aComponentSize.empty() ? 0 : *std::max_element(aComponentSize.begin(), aComponentSize.end());
+	bTypeIndexValid = true;
+}
+
+/*
+ * a match maps every signature edge onto a code edge, so each connected piece of the signature
+ * lands within a single code component holding at least as many non-opaque nodes
+ */
+void DFGraphImpl::Components(std::vector<int> &aComponent, std::vector<unsigned int> &aSize) const {
+	std::unordered_map<unsigned int, DFGNode>::const_iterator it, itNext;
+	std::vector<DFGNode> aQueue;
+	size_t i;
+
+	aComponent.assign(dwNodeCounter, -1);
+	aSize.clear();
+	for (it = aIdMap.begin(); it != aIdMap.end(); it++) {
+		if (aComponent[it->first] != -1) {
+			continue;
+		}
+		aComponent[it->first] = (int)aSize.size();
+		aSize.push_back(0);
+		aQueue.assign(1, it->second);
+		for (i = 0; i < aQueue.size(); i++) {
+			DFGNode oNode = aQueue[i];
+			if (!NODE_IS_OPAQUE(oNode)) {
+				aSize.back()++;
+			}
+			for (itNext = oNode->aInputNodesUnique.begin(); itNext != oNode->aInputNodesUnique.end(); itNext++) {
+				if (aComponent[itNext->first] == -1) {
+					aComponent[itNext->first] = aComponent[it->first];
+					aQueue.push_back(itNext->second);
+				}
+			}
+			for (itNext = oNode->aOutputNodes.begin(); itNext != oNode->aOutputNodes.end(); itNext++) {
+				if (aComponent[itNext->first] == -1) {
+					aComponent[itNext->first] = aComponent[it->first];
+					aQueue.push_back(itNext->second);
+				}
+			}
+		}
+	}
+}
+
+static inline void FingerprintCount(unsigned long long &qwCounts, node_type_t eNodeType) {
+	if (eNodeType != NODE_TYPE_OPAQUE && ((qwCounts >> (eNodeType * 4)) & 0xf) < 7) {
+		qwCounts += 1ULL << (eNodeType * 4);
+	}
+	if (((qwCounts >> (NODE_TYPE_OPAQUE * 4)) & 0xf) < 7) {
+		qwCounts += 1ULL << (NODE_TYPE_OPAQUE * 4);
+	}
+}
+
+node_fingerprint_t DFGraphImpl::ComputeFingerprint(const DFGNode &oNode) {
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itIn, itIn2, itOut;
+	std::vector<unsigned int> aSeen;
+	node_fingerprint_t stFingerprint;
+
+	stFingerprint.qwInputs = 0;
+	stFingerprint.qwOutputs = 0;
+	stFingerprint.qwInputs2 = 0;
+	for (itOut = oNode->aOutputNodes.begin(); itOut != oNode->aOutputNodes.end(); itOut++) {
+		FingerprintCount(stFingerprint.qwOutputs, itOut->second->eNodeType);
+	}
+	aSeen.push_back(oNode->dwNodeId);
+	for (itIn = oNode->aInputNodesUnique.begin(); itIn != oNode->aInputNodesUnique.end(); itIn++) {
+		FingerprintCount(stFingerprint.qwInputs, itIn->second->eNodeType);
+		if (std::find(aSeen.begin(), aSeen.end(), itIn->first) == aSeen.end()) {
+			aSeen.push_back(itIn->first);
+			FingerprintCount(stFingerprint.qwInputs2, itIn->second->eNodeType);
+		}
+		for (itIn2 = itIn->second->aInputNodesUnique.begin(); itIn2 != itIn->second->aInputNodesUnique.end(); itIn2++) {
+			if (std::find(aSeen.begin(), aSeen.end(), itIn2->first) == aSeen.end()) {
+				aSeen.push_back(itIn2->first);
+				FingerprintCount(stFingerprint.qwInputs2, itIn2->second->eNodeType);
+			}
+		}
+	}
+	return stFingerprint;
+}
+
+/* depth first along the inputs, a node is hashed once all of its inputs are */
+void DFGraphImpl::HashCones() {
+	std::unordered_map<unsigned int, DFGNode>::iterator it;
+	std::vector<std::pair<DFGNode, std::list<DFGNode>::const_iterator>> aStack;
+	std::list<DFGNode>::const_iterator itIn;
+	std::vector<char> aState; // 0 : not visited, 1 : on the stack, 2 : hashed
+
+	aConeHash.assign(dwNodeCounter, 0);
+	aState.assign(dwNodeCounter, 0);
+	for (it = aIdMap.begin(); it != aIdMap.end(); it++) {
+		if (aState[it->first]) {
+			continue;
+		}
+		aState[it->first] = 1;
+		aStack.push_back(std::make_pair(it->second, it->second->aInputNodes.begin()));
+		while (aStack.begin() != aStack.end()) {
+			DFGNode oNode = aStack.back().first;
+			itIn = aStack.back().second;
+			while (itIn != oNode->aInputNodes.end() && aState[(*itIn)->dwNodeId] != 0) {
+				itIn++;
+			}
+			if (itIn != oNode->aInputNodes.end()) {
+				aStack.back().second = itIn;
+				aState[(*itIn)->dwNodeId] = 1;
+				aStack.push_back(std::make_pair(*itIn, (*itIn)->aInputNodes.begin()));
+				continue;
+			}
+
+			unsigned long long qwHash = HashCombine(oNode->eNodeType, NODE_IS_CONSTANT(oNode) ? oNode->toConstant()->dwValue : 0);
+			/* the fingerprint summarizes what IsCandidate sees outside the cone */
+			qwHash = HashCombine(qwHash, aFingerprint[oNode->dwNodeId].qwInputs);
+			qwHash = HashCombine(qwHash, aFingerprint[oNode->dwNodeId].qwOutputs);
+			qwHash = HashCombine(qwHash, aFingerprint[oNode->dwNodeId].qwInputs2);
+			for (itIn = oNode->aInputNodes.begin(); itIn != oNode->aInputNodes.end(); itIn++) {
+				/* an input still on the stack closes a cycle, it hashes as 0 */
+				qwHash = HashCombine(qwHash, aConeHash[(*itIn)->dwNodeId]);
+			}
+			aConeHash[oNode->dwNodeId] = qwHash;
+			aState[oNode->dwNodeId] = 2;
+			aStack.pop_back();
+		}
+	}
+}
+
+const std::vector<DFGNode> &DFGraphImpl::ConstantsWithValue(unsigned int dwValue) const {
+	static const std::vector<DFGNode> aNone;
+	std::unordered_map<unsigned int, std::vector<DFGNode>>::const_iterator it = aConstantIndex.find(dwValue);
+	return it == aConstantIndex.end() ? aNone : it->second;
+}
+
+unsigned int DFGraphImpl::CountByConstantAmount(node_type_t eNodeType, unsigned int dwAmount) const {
+	std::unordered_map<unsigned long long, unsigned int>::const_iterator it;
+	it = aConstantAmounts.find(((unsigned long long)eNodeType << 32) | dwAmount);
+	return it == aConstantAmounts.end() ? 0 : it->second;
+}
+
 DFGraph DFGraphImpl::fork() const {
 	std::unordered_map<unsigned int,DFGNode>::const_iterator it;
 	DFGraph oFork(DFGraph::create());
@@ -103,4 +335,83 @@ DFGraph DFGraphImpl::fork() const {
 	}
 
 	return oFork;
+}
+
+/*
+ * copy without the nodes no signature can map to : a signature node maps onto a code node of its own type,
+ * an opaque one onto an input of such a node. nodes of any other type that feed none of these are dropped,
+ * nodes of such types that do lose their dropped inputs (opaques don't look below), the others keep all of theirs.
+ * nullptr if nothing would be dropped
+ */
+DFGraph DFGraphImpl::Reduce(const bool aKeepType[NODE_TYPE_MAX]) const {
+	std::unordered_map<unsigned int, DFGNode>::const_iterator it, itOut;
+	std::vector<char> aDropped;
+	size_t dwNumDropped = 0;
+
+	aDropped.assign(dwNodeCounter, 0);
+	for (it = aIdMap.begin(); it != aIdMap.end(); it++) {
+		if (aKeepType[it->second->eNodeType]) {
+			continue;
+		}
+		for (itOut = it->second->aOutputNodes.begin(); itOut != it->second->aOutputNodes.end(); itOut++) {
+			if (aKeepType[itOut->second->eNodeType]) {
+				break;
+			}
+		}
+		if (itOut == it->second->aOutputNodes.end()) {
+			aDropped[it->first] = 1;
+			dwNumDropped++;
+		}
+	}
+	if (dwNumDropped == 0) {
+		return nullptr;
+	}
+	/* only the kept nodes are copied, so the view never holds more than what it keeps */
+	DFGraph oView(DFGraph::create());
+	oView->dwNodeCounter = dwNodeCounter;
+	for (it = aIdMap.begin(); it != aIdMap.end(); it++) {
+		if (!aDropped[it->first] && oView->CopyKept(it->second, aDropped) == nullptr) {
+			return nullptr;
+		}
+	}
+	return oView;
+}
+
+/* Reduce helper function : CopyNode, without the inputs flagged in aDropped */
+DFGNode DFGraphImpl::CopyKept(const DFGNode &oNode, const std::vector<char> &aDropped, unsigned int dwStackSize) {
+	std::unordered_map<unsigned int,DFGNode>::iterator it;
+	if ((it = aIdMap.find(oNode->dwNodeId)) != aIdMap.end()) {
+		return it->second;
+	}
+	if (dwStackSize == 0) {
+		return nullptr;
+	}
+	DFGNode oCopy = oNode->copy();
+	std::list<DFGNode>::const_iterator itUp;
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itDown;
+
+	for (itUp = oNode->aInputNodes.begin(); itUp != oNode->aInputNodes.end(); itUp++) {
+		if (aDropped[(*itUp)->dwNodeId]) {
+			continue;
+		}
+		DFGNode oInput = CopyKept(*itUp, aDropped, dwStackSize - 1);
+		if (oInput == nullptr) {
+			return nullptr;
+		}
+		oCopy->aInputNodes.push_back(oInput);
+		itDown = oInput->aOutputNodes.find(oCopy->dwNodeId);
+		if (itDown == oInput->aOutputNodes.end()) {
+			oInput->aOutputNodes.insert(std::pair<unsigned int, DFGNode>(oCopy->dwNodeId, oCopy));
+		}
+		if (oCopy->aInputNodesUnique.find(oInput->dwNodeId) == oCopy->aInputNodesUnique.end()) {
+			oCopy->aInputNodesUnique.insert(std::pair<unsigned int, DFGNode>(oInput->dwNodeId, oInput));
+		}
+	}
+
+	aNodeTypeCount[oCopy->eNodeType]++;
+	Account(oCopy, true);
+	aIdMap.insert(std::pair<unsigned int, DFGNode>(oCopy->dwNodeId, oCopy));
+	/* keyed by the original's index string, the view is read-only and never looked up by index */
+	insert(std::pair<std::string, DFGNode>(oNode->idx(), oCopy));
+	return oCopy;
 }
\ No newline at end of file
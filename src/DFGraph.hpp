@@ -1,10 +1,39 @@
 #pragma once
 
+#include <atomic>
 #include <list>
+#include <vector>
 #include <unordered_map>
 #include <string>
 
 #include "types.hpp"
+#include "DFGNode.hpp"
+
+static inline unsigned long long HashCombine(unsigned long long qwSeed, unsigned long long qwValue) {
+	qwValue *= 0x9e3779b97f4a7c15ULL;
+	qwValue ^= qwValue >> 29;
+	return (qwSeed ^ qwValue) * 0x100000001b3ULL;
+}
+
+/*
+ * neighbourhood of a node, one saturating 3 bit count per node type (NODE_TYPE_MAX nibbles) :
+ * distinct inputs, distinct outputs and distinct nodes within two input edges.
+ * opaque signature nodes match any type, the NODE_TYPE_OPAQUE nibble counts every neighbour instead
+ */
+typedef struct node_fingerprint_t {
+	unsigned long long qwInputs;
+	unsigned long long qwOutputs;
+	unsigned long long qwInputs2;
+} node_fingerprint_t;
+
+#define FINGERPRINT_HIGH_BITS 0x8888888888888888ULL
+
+/* each count of oCode is at least the matching count of oSignature */
+static inline bool FingerprintDominates(const node_fingerprint_t &oCode, const node_fingerprint_t &oSignature) {
+	return (((oCode.qwInputs | FINGERPRINT_HIGH_BITS) - oSignature.qwInputs) & FINGERPRINT_HIGH_BITS) == FINGERPRINT_HIGH_BITS &&
+		(((oCode.qwOutputs | FINGERPRINT_HIGH_BITS) - oSignature.qwOutputs) & FINGERPRINT_HIGH_BITS) == FINGERPRINT_HIGH_BITS &&
+		(((oCode.qwInputs2 | FINGERPRINT_HIGH_BITS) - oSignature.qwInputs2) & FINGERPRINT_HIGH_BITS) == FINGERPRINT_HIGH_BITS;
+}
 
 class DFGraphImpl : virtual public ReferenceCounted, public std::unordered_map<std::string, DFGNode> {
 public:
@@ -12,6 +41,15 @@ public:
 	~DFGraphImpl();
 
 	unsigned int dwNodeCounter;
+	unsigned int aNodeTypeCount[NODE_TYPE_MAX];
+	/* estimated heap usage of this graph's nodes */
+	size_t qwLiveBytes;
+	/* same, summed over all graphs being built or evaluated (see Retire) */
+	static inline size_t LiveBytes() { return qwGlobalLiveBytes; }
+	/* the graph is only kept around (for display, as a signature) : it stops counting against the memory budget */
+	void Retire();
+	static inline size_t PeakLiveBytes() { return qwGlobalPeakBytes; }
+	static inline size_t PeakGraphBytes() { return qwGraphPeakBytes; }
 	inline DFGNode FindNode(const std::string &szIndex) {
 		std::unordered_map<std::string, DFGNode>::iterator it;
 		it = find(szIndex);
@@ -25,10 +63,55 @@ public:
 	void InsertNode(DFGNode oNode);
 	void RemoveNode(DFGNode oNode);
 
+	/*
+	 * nodes by type and constants by value, built once the graph is final
+	 * (read-only afterwards, so shared by all evaluators). any change to the graph drops it
+	 */
+	void BuildTypeIndex();
+	inline bool HasTypeIndex() const { return bTypeIndexValid; }
+	inline const std::vector<DFGNode> &NodesOfType(node_type_t eNodeType) const { return aTypeIndex[eNodeType]; }
+	const std::vector<DFGNode> &ConstantsWithValue(unsigned int dwValue) const;
+	/* structural invariants gathered with the index, see MatchPlanImpl::MayMatch */
+	inline unsigned int MaxArity(node_type_t eNodeType) const { return aMaxArity[eNodeType]; }
+	unsigned int CountByConstantAmount(node_type_t eNodeType, unsigned int dwAmount) const;
+	/*
+	 * hash of a node's type, constant value, fingerprint and, in order, its inputs' hashes.
+	 * nodes of equal hash, in this or any other graph, have equal pass 1 verdicts
+	 */
+	inline unsigned long long ConeHash(unsigned int dwNodeId) const { return aConeHash[dwNodeId]; }
+	inline const node_fingerprint_t &Fingerprint(unsigned int dwNodeId) const { return aFingerprint[dwNodeId]; }
+	static node_fingerprint_t ComputeFingerprint(const DFGNode &oNode);
+	/* weakly connected components, sized by their number of non-opaque nodes */
+	inline unsigned int ComponentSize(unsigned int dwNodeId) const { return aComponentSize[aComponent[dwNodeId]]; }
+	inline unsigned int SmallestComponent() const { return dwSmallestComponent; }
+	inline unsigned int LargestComponent() const { return dwLargestComponent; }
+	void Components(std::vector<int> &aComponent, std::vector<unsigned int> &aSize) const;
+
 	std::unordered_map<unsigned int, DFGNode> aIdMap;
 	DFGraph fork() const;
+	DFGraph Reduce(const bool aKeepType[NODE_TYPE_MAX]) const;
 
 private:
 	/* fork helper function */
 	DFGNode CopyNode(const DFGNode &oNode, unsigned int dwStackSize=10000);
+	DFGNode CopyKept(const DFGNode &oNode, const std::vector<char> &aDropped, unsigned int dwStackSize=10000);
+	void Account(DFGNode oNode, bool bInsert);
+	void HashCones();
+
+	bool bTypeIndexValid;
+	bool bRetired;
+	std::vector<DFGNode> aTypeIndex[NODE_TYPE_MAX];
+	std::unordered_map<unsigned int, std::vector<DFGNode>> aConstantIndex;
+	unsigned int aMaxArity[NODE_TYPE_MAX];
+	std::unordered_map<unsigned long long, unsigned int> aConstantAmounts; // shifts/rotates by a constant, (type << 32 | amount) -> count
+	std::vector<unsigned long long> aConeHash; // by node id
+	std::vector<node_fingerprint_t> aFingerprint; // by node id
+	std::vector<int> aComponent; // by node id
+	std::vector<unsigned int> aComponentSize; // by component
+	unsigned int dwSmallestComponent;
+	unsigned int dwLargestComponent;
+
+	static std::atomic<size_t> qwGlobalLiveBytes;
+	static std::atomic<size_t> qwGlobalPeakBytes;
+	static std::atomic<size_t> qwGraphPeakBytes;
 };
\ No newline at end of file
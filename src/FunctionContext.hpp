@@ -0,0 +1,151 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "types.hpp"
+
+/*
+ * cooperative cancellation : the owner of a token flags it,
+ * long running tasks poll it and bail out at their next check
+ */
+class CancellationTokenImpl : virtual public ReferenceCounted {
+public:
+	inline CancellationTokenImpl() : bCancelled(false) { }
+	inline void Cancel() { bCancelled.store(true, std::memory_order_relaxed); }
+	inline bool IsCancelled() const { return bCancelled.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<bool> bCancelled;
+};
+
+/* pass 1 verdicts kept per signature and function, further ones are dropped */
+#define VERDICT_SET_MAX_ENTRIES (1 << 14)
+/* initial number of slots of a verdict set, doubled whenever it gets half full */
+#define VERDICT_SET_MIN_SLOTS 256
+
+typedef struct verdict_slot_t {
+	std::atomic<unsigned long long> qwKey; // 0 if free
+	std::atomic<unsigned int> dwGeneration; // publication that added the key
+} verdict_slot_t;
+
+/*
+ * (signature node class, code cone hash) pairs known to fail pass 1, keyed as in SignatureEvaluatorImpl::VerdictKey.
+ * append only open addressing : a single writer (under FunctionContextImpl::stVerdictMutex) stamps each key
+ * with its publication, readers look up without locking and ignore keys published after their snapshot
+ */
+class VerdictSetImpl : virtual public ReferenceCounted {
+public:
+	inline VerdictSetImpl(unsigned int dwNumSlots = VERDICT_SET_MIN_SLOTS)
+		: aSlots(dwNumSlots), dwSize(0), dwGeneration(0) { }
+
+	inline bool Contains(unsigned long long qwKey, unsigned int dwSnapshot) const {
+		size_t i = Slot(qwKey);
+		unsigned long long qwFound;
+		while ((qwFound = aSlots[i].qwKey.load(std::memory_order_acquire)) != 0) {
+			if (qwFound == qwKey) {
+				return aSlots[i].dwGeneration.load(std::memory_order_relaxed) <= dwSnapshot;
+			}
+			i = (i + 1) & (aSlots.size() - 1);
+		}
+		return false;
+	}
+	/* writer only, false once the set is full */
+	inline bool Insert(unsigned long long qwKey, unsigned int dwStamp) {
+		size_t i = Slot(qwKey);
+		unsigned long long qwFound;
+		if (qwKey == 0 || IsFull() || IsCrowded()) {
+			return false;
+		}
+		while ((qwFound = aSlots[i].qwKey.load(std::memory_order_relaxed)) != 0) {
+			if (qwFound == qwKey) {
+				return true;
+			}
+			i = (i + 1) & (aSlots.size() - 1);
+		}
+		aSlots[i].dwGeneration.store(dwStamp, std::memory_order_relaxed);
+		aSlots[i].qwKey.store(qwKey, std::memory_order_release);
+		dwSize++;
+		return true;
+	}
+	/* writer only, same keys and stamps in twice as many slots */
+	inline VerdictSet Grow() const {
+		VerdictSet oGrown = VerdictSet::create((unsigned int)aSlots.size() * 2);
+		size_t i;
+		for (i = 0; i < aSlots.size(); i++) {
+			if (aSlots[i].qwKey.load(std::memory_order_relaxed) != 0) {
+				oGrown->Insert(aSlots[i].qwKey.load(std::memory_order_relaxed), aSlots[i].dwGeneration.load(std::memory_order_relaxed));
+			}
+		}
+		oGrown->dwGeneration = dwGeneration;
+		return oGrown;
+	}
+	inline bool IsFull() const { return dwSize >= VERDICT_SET_MAX_ENTRIES; }
+	inline bool IsCrowded() const { return (dwSize + 1) * 2 > aSlots.size(); }
+
+	std::vector<verdict_slot_t> aSlots;
+	unsigned int dwSize;
+	unsigned int dwGeneration; // last publication, readers snapshot it under the context's mutex
+
+private:
+	inline size_t Slot(unsigned long long qwKey) const {
+		return (size_t)((qwKey ^ (qwKey >> 29)) * 0x9e3779b97f4a7c15ULL >> 17) & (aSlots.size() - 1);
+	}
+};
+
+/*
+ * state shared by all paths (forks) of a single function
+ */
+class FunctionContextImpl : virtual public ReferenceCounted {
+public:
+	inline FunctionContextImpl(unsigned long lpFunctionAddress)
+		: lpFunctionAddress(lpFunctionAddress), oToken(CancellationToken::create()) { }
+
+	unsigned long lpFunctionAddress;
+	/* cancels construction of the function's remaining paths */
+	CancellationToken oToken;
+	/* identifiers of signatures matched on any path, only accessed by the coordinator */
+	std::unordered_map<std::string, char> aMatched;
+
+	/* pass 1 verdicts of one signature, shared by the evaluations of sibling paths, dwSnapshot receives the last publication */
+	inline VerdictSet Verdicts(const std::string &szIdentifier, unsigned int &dwSnapshot) {
+		std::unique_lock<std::mutex> mLock(stVerdictMutex);
+		std::unordered_map<std::string, VerdictSet>::iterator it = aVerdicts.find(szIdentifier);
+		if (it == aVerdicts.end()) {
+			dwSnapshot = 0;
+			return nullptr;
+		}
+		dwSnapshot = it->second->dwGeneration;
+		return it->second;
+	}
+	/*
+	 * appended in place, in O(aNew) amortized : sets handed out earlier either see the new keys
+	 * under a later stamp, or are left behind whole when the set grows
+	 */
+	inline void PublishVerdicts(const std::string &szIdentifier, const std::vector<unsigned long long> &aNew) {
+		std::unique_lock<std::mutex> mLock(stVerdictMutex);
+		VerdictSet &oVerdicts = aVerdicts[szIdentifier];
+		std::vector<unsigned long long>::const_iterator it;
+		unsigned int dwStamp;
+
+		if (oVerdicts == nullptr) {
+			oVerdicts = VerdictSet::create();
+		}
+		dwStamp = oVerdicts->dwGeneration + 1;
+		for (it = aNew.begin(); it != aNew.end() && !oVerdicts->IsFull(); it++) {
+			if (oVerdicts->IsCrowded()) {
+				oVerdicts = oVerdicts->Grow();
+			}
+			oVerdicts->Insert(*it, dwStamp);
+		}
+		oVerdicts->dwGeneration = dwStamp;
+	}
+
+private:
+	std::unordered_map<std::string, VerdictSet> aVerdicts;
+	std::mutex stVerdictMutex;
+};
@@ -0,0 +1,402 @@
+#include <cstring>
+#include <algorithm>
+#include <list>
+#include <mutex>
+
+#include "MatchPlan.hpp"
+#include "Broker.hpp"
+#include "DFGraph.hpp"
+#include "SignatureParser.hpp"
+
+/*
+ * pass 1 only looks at a signature node's type, its constant value, its input order,
+ * its neighbourhood fingerprint and, recursively, its inputs : nodes agreeing on all of these share a class id,
+ * interned over every plan so equal sub-patterns of different variants (and signatures) line up
+ */
+std::mutex g_stClassMutex;
+std::map<std::vector<unsigned int>, unsigned int> g_aClasses;
+
+bool g_bReduce = false;
+bool g_aKeepType[NODE_TYPE_MAX];
+
+unsigned int MatchPlanImpl::Classify(const DFGNode &oNode, std::vector<int> &aClassOf) {
+	std::vector<unsigned int> aKey;
+	std::list<DFGNode>::const_iterator itOrder;
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itIn;
+	std::map<std::vector<unsigned int>, unsigned int>::iterator itClass;
+	DFGNode oCopy = oNode;
+
+	if (aClassOf[oNode->dwNodeId] != -1) {
+		return aClassOf[oNode->dwNodeId];
+	}
+	aKey.push_back(oNode->eNodeType);
+	aKey.push_back(NODE_IS_CONSTANT(oNode) ? oCopy->toConstant()->dwValue : 0);
+	aKey.push_back(NODE_HAS_ORDERED_INPUTS(oNode) ? 1 : 0);
+	/* IsCandidate looks at the neighbourhood too */
+	node_fingerprint_t stFingerprint = DFGraphImpl::ComputeFingerprint(oNode);
+	aKey.push_back((unsigned int)stFingerprint.qwInputs);
+	aKey.push_back((unsigned int)(stFingerprint.qwInputs >> 32));
+	aKey.push_back((unsigned int)stFingerprint.qwOutputs);
+	aKey.push_back((unsigned int)(stFingerprint.qwOutputs >> 32));
+	aKey.push_back((unsigned int)stFingerprint.qwInputs2);
+	aKey.push_back((unsigned int)(stFingerprint.qwInputs2 >> 32));
+	if (NODE_HAS_ORDERED_INPUTS(oNode)) {
+		for (itOrder = oNode->aInputNodes.begin(); itOrder != oNode->aInputNodes.end(); itOrder++) {
+			aKey.push_back(Classify(*itOrder, aClassOf));
+		}
+	} else {
+		/* forall inputs : exists, neither order nor multiplicity matter */
+		for (itIn = oNode->aInputNodesUnique.begin(); itIn != oNode->aInputNodesUnique.end(); itIn++) {
+			aKey.push_back(Classify(itIn->second, aClassOf));
+		}
+		std::sort(aKey.begin() + 9, aKey.end());
+		aKey.erase(std::unique(aKey.begin() + 9, aKey.end()), aKey.end());
+	}
+
+	itClass = g_aClasses.find(aKey);
+	if (itClass == g_aClasses.end()) {
+		itClass = g_aClasses.insert(std::pair<std::vector<unsigned int>, unsigned int>(aKey, (unsigned int)g_aClasses.size())).first;
+	}
+	aClassOf[oNode->dwNodeId] = (int)itClass->second;
+	return itClass->second;
+}
+
+MatchPlanImpl::MatchPlanImpl(SignatureBroker &oSignatureGraph) {
+	DFGraph oGraph = oSignatureGraph->oGraph;
+	DFGraphImpl::const_iterator it;
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itIn, itOut;
+	std::list<DFGNode> aQueue;
+	std::vector<plan_node_t>::iterator itNode;
+	std::vector<int> aClassOf, aComponent;
+	std::vector<unsigned int> aComponentSize;
+
+	dwNodeCounter = oGraph->dwNodeCounter;
+	aNodeIndex.assign(dwNodeCounter, -1);
+	memset(aTypeCount, 0, sizeof(aTypeCount));
+	memset(aMaxArity, 0, sizeof(aMaxArity));
+	bReducible = true;
+
+	for (it = oGraph->begin(); it != oGraph->end(); it++) {
+		if (it->second->aOutputNodes.begin() == it->second->aOutputNodes.end()) {
+			aQueue.push_back(it->second);
+			aNodeIndex[it->second->dwNodeId] = 0;
+		}
+	}
+
+	while (aQueue.begin() != aQueue.end()) {
+		DFGNode oNode = aQueue.front();
+		plan_node_t stNode;
+		aQueue.pop_front();
+
+		stNode.oNode = oNode;
+		stNode.bOrdered = NODE_HAS_ORDERED_INPUTS(oNode);
+		stNode.bRoot = oNode->aOutputNodes.begin() == oNode->aOutputNodes.end();
+		stNode.dwOpaqueRefId = NODE_IS_OPAQUE(oNode) ? oNode->toOpaque()->dwOpaqueRefId : -1;
+		stNode.dwDegree = (unsigned int)(oNode->aInputNodesUnique.size() + oNode->aOutputNodes.size());
+		stNode.stFingerprint = DFGraphImpl::ComputeFingerprint(oNode);
+
+		aNodeIndex[oNode->dwNodeId] = (int)aNodes.size();
+		aNodes.push_back(stNode);
+		if (stNode.bRoot) {
+			aRoots.push_back(oNode->dwNodeId);
+		}
+		if (NODE_IS_OPAQUE(oNode)) {
+			if (oNode->aInputNodes.begin() != oNode->aInputNodes.end() || stNode.bRoot) {
+				bReducible = false;
+			}
+			for (itOut = oNode->aOutputNodes.begin(); itOut != oNode->aOutputNodes.end(); itOut++) {
+				if (NODE_IS_OPAQUE(itOut->second)) {
+					bReducible = false;
+				}
+			}
+		}
+		if (stNode.dwOpaqueRefId != -1) {
+			aOpaqueIdToNode.insert(std::pair<int, unsigned int>(stNode.dwOpaqueRefId, oNode->dwNodeId));
+		}
+		if (!NODE_IS_OPAQUE(oNode)) {
+			/* distinct signature nodes map to distinct code nodes */
+			aTypeCount[oNode->eNodeType]++;
+			if (NODE_ARITY(oNode) > aMaxArity[oNode->eNodeType]) {
+				aMaxArity[oNode->eNodeType] = (unsigned int)NODE_ARITY(oNode);
+			}
+			if (NODE_IS_CONSTANT(oNode)) {
+				aConstants.push_back(oNode->toConstant()->dwValue);
+			} else if ((NODE_IS_SHIFT(oNode) || NODE_IS_ROTATE(oNode)) &&
+				oNode->aInputNodes.size() == 2 && NODE_IS_CONSTANT(oNode->aInputNodes.back())
+			) {
+				aConstantAmounts[((unsigned long long)oNode->eNodeType << 32) | oNode->aInputNodes.back()->toConstant()->dwValue]++;
+			}
+		}
+
+		for (itIn = oNode->aInputNodesUnique.begin(); itIn != oNode->aInputNodesUnique.end(); itIn++) {
+			if (aNodeIndex[itIn->first] == -1) {
+				aNodeIndex[itIn->first] = 0; // queued
+				aQueue.push_back(itIn->second);
+			}
+		}
+	}
+
+	/* see DFGraphImpl::Components */
+	oGraph->Components(aComponent, aComponentSize);
+	dwLargestComponent = 0;
+	for (itNode = aNodes.begin(); itNode != aNodes.end(); itNode++) {
+		itNode->dwComponentSize = aComponentSize[aComponent[itNode->oNode->dwNodeId]];
+		if (itNode->dwComponentSize > dwLargestComponent) {
+			dwLargestComponent = itNode->dwComponentSize;
+		}
+	}
+
+	ComputeAnchors();
+	if (aNodes.size() >= SIGNATURE_CORE_MIN_NODES) {
+		Minimize(oSignatureGraph);
+	}
+
+	aClassOf.assign(dwNodeCounter, -1);
+	std::unique_lock<std::mutex> mLock(g_stClassMutex);
+	for (itNode = aNodes.begin(); itNode != aNodes.end(); itNode++) {
+		itNode->dwClassId = Classify(itNode->oNode, aClassOf);
+	}
+}
+
+void MatchPlanImpl::SetLoaded(const std::list<SignatureDefinition> &aSignatures) {
+	std::list<SignatureDefinition>::const_iterator it;
+	SignatureDefinitionImpl::const_iterator itVariant;
+	int i;
+
+	g_bReduce = aSignatures.begin() != aSignatures.end();
+	memset(g_aKeepType, 0, sizeof(g_aKeepType));
+	for (it = aSignatures.begin(); it != aSignatures.end(); it++) {
+		for (itVariant = (*it)->begin(); itVariant != (*it)->end(); itVariant++) {
+			MatchPlan oPlan = (*itVariant)->oMatchPlan;
+			if (oPlan == nullptr || !oPlan->bReducible) {
+				g_bReduce = false;
+				return;
+			}
+			for (i = 0; i < NODE_TYPE_MAX; i++) {
+				g_aKeepType[i] = g_aKeepType[i] || oPlan->aTypeCount[i] != 0;
+			}
+		}
+	}
+}
+
+bool MatchPlanImpl::KeepTypes(bool aKeepType[NODE_TYPE_MAX]) {
+	if (g_bReduce) {
+		memcpy(aKeepType, g_aKeepType, sizeof(g_aKeepType));
+	}
+	return g_bReduce;
+}
+
+/*
+ * necessary conditions only : the mapping is injective and preserves
+ * node types, constant values and (for ordered nodes) input positions,
+ * so each count gathered here is a lower bound on what the code graph must hold
+ */
+bool MatchPlanImpl::MayMatch(const DFGraph &oCode) const {
+	std::unordered_map<unsigned long long, unsigned int>::const_iterator it;
+	std::vector<unsigned int>::const_iterator itConstant;
+	int i;
+
+	if (!oCode->HasTypeIndex()) {
+		return true;
+	}
+	if (dwLargestComponent > oCode->LargestComponent()) {
+		return false;
+	}
+	for (i = 0; i < NODE_TYPE_MAX; i++) {
+		if (aTypeCount[i] > oCode->aNodeTypeCount[i] || aMaxArity[i] > oCode->MaxArity((node_type_t)i)) {
+			return false;
+		}
+	}
+	for (itConstant = aConstants.begin(); itConstant != aConstants.end(); itConstant++) {
+		if (oCode->ConstantsWithValue(*itConstant).empty()) {
+			return false;
+		}
+	}
+	for (it = aConstantAmounts.begin(); it != aConstantAmounts.end(); it++) {
+		if (it->second > oCode->CountByConstantAmount((node_type_t)(it->first >> 32), (unsigned int)it->first)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * a match maps each input edge of the signature to an input edge of the code,
+ * so the image of a root lies at most dwDepth output edges above the image of its anchor
+ */
+void MatchPlanImpl::ComputeAnchors() {
+	std::vector<unsigned int> aOrder;
+	std::vector<unsigned int> aPending;
+	std::vector<int> aDepth;
+	std::vector<unsigned int>::const_iterator itRoot, itOrder;
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itIn;
+	size_t i;
+
+	/* topological order, outputs before inputs */
+	aPending.assign(dwNodeCounter, 0);
+	for (i = 0; i < aNodes.size(); i++) {
+		aPending[aNodes[i].oNode->dwNodeId] = (unsigned int)aNodes[i].oNode->aOutputNodes.size();
+	}
+	aOrder = aRoots;
+	for (i = 0; i < aOrder.size(); i++) {
+		const DFGNode &oNode = Node(aOrder[i]).oNode;
+		for (itIn = oNode->aInputNodesUnique.begin(); itIn != oNode->aInputNodesUnique.end(); itIn++) {
+			if (--aPending[itIn->first] == 0) {
+				aOrder.push_back(itIn->first);
+			}
+		}
+	}
+
+	/* longest distance from each root */
+	for (itRoot = aRoots.begin(); itRoot != aRoots.end(); itRoot++) {
+		aDepth.assign(dwNodeCounter, -1);
+		aDepth[*itRoot] = 0;
+		aAnchors.push_back(std::vector<plan_anchor_t>());
+		for (itOrder = aOrder.begin(); itOrder != aOrder.end(); itOrder++) {
+			const DFGNode &oNode = Node(*itOrder).oNode;
+			if (aDepth[*itOrder] == -1) {
+				continue;
+			}
+			if (!NODE_IS_OPAQUE(oNode)) {
+				plan_anchor_t stAnchor;
+				stAnchor.dwNodeId = *itOrder;
+				stAnchor.dwDepth = aDepth[*itOrder];
+				aAnchors.back().push_back(stAnchor);
+			}
+			for (itIn = oNode->aInputNodesUnique.begin(); itIn != oNode->aInputNodesUnique.end(); itIn++) {
+				if (aDepth[itIn->first] < aDepth[*itOrder] + 1) {
+					aDepth[itIn->first] = aDepth[*itOrder] + 1;
+				}
+			}
+		}
+	}
+}
+
+unsigned int MatchPlanImpl::Rarity(const DFGNode &oNode) {
+	DFGNode oCopy = oNode;
+
+	switch (oNode->eNodeType) {
+	case NODE_TYPE_CONSTANT:
+		/* round constants and other magic values, small ones (and their negation) show up everywhere */
+		return oCopy->toConstant()->dwValue > 0xff && oCopy->toConstant()->dwValue < 0xffffff00 ? 8 : 1;
+	case NODE_TYPE_ROTATE:
+	case NODE_TYPE_MULT:
+		return 4;
+	case NODE_TYPE_SHIFT:
+	case NODE_TYPE_LOAD:
+	case NODE_TYPE_STORE:
+		return 2;
+	case NODE_TYPE_OPAQUE:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * greedily grows a connected core out of the signature's rarest nodes, constant inputs come along for free.
+ * the core keeps the edges among its nodes and turns every other input into a wildcard,
+ * so any match of the signature restricts to a match of the core : a cheap necessary condition,
+ * seldom met by accident, the evaluator only tries the full signature behind it
+ */
+void MatchPlanImpl::Minimize(SignatureBroker &oSignatureGraph) {
+	std::vector<char> aInCore, aFrontier;
+	std::vector<DFGNode> aJoin, aRemoved;
+	std::vector<DFGNode>::iterator itNode;
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itIn, itOut;
+	std::unordered_map<unsigned int, DFGNode> aWildcards;
+	std::list<DFGNode>::iterator itInput;
+	DFGraphImpl::const_iterator it;
+	unsigned int dwCoreSize = 0, dwJoined = 0, dwTotal = 0;
+	size_t i, dwPick;
+
+	aInCore.assign(dwNodeCounter, 0);
+	aFrontier.assign(dwNodeCounter, 0);
+	while (dwCoreSize < SIGNATURE_CORE_NODES) {
+		dwPick = aNodes.size();
+		for (i = 0; i < aNodes.size(); i++) {
+			const plan_node_t &stNode = aNodes[i];
+			if (aInCore[stNode.oNode->dwNodeId] || NODE_IS_OPAQUE(stNode.oNode) || (dwCoreSize != 0 && !aFrontier[stNode.oNode->dwNodeId])) {
+				continue;
+			}
+			if (dwPick == aNodes.size() ||
+				Rarity(stNode.oNode) > Rarity(aNodes[dwPick].oNode) ||
+				(Rarity(stNode.oNode) == Rarity(aNodes[dwPick].oNode) && stNode.dwDegree > aNodes[dwPick].dwDegree)
+			) {
+				dwPick = i;
+			}
+		}
+		if (dwPick == aNodes.size()) {
+			break;
+		}
+
+		aJoin.assign(1, aNodes[dwPick].oNode);
+		for (itIn = aJoin[0]->aInputNodesUnique.begin(); itIn != aJoin[0]->aInputNodesUnique.end(); itIn++) {
+			if (NODE_IS_CONSTANT(itIn->second) && !aInCore[itIn->first]) {
+				aJoin.push_back(itIn->second);
+			}
+		}
+		for (itNode = aJoin.begin(); itNode != aJoin.end(); itNode++) {
+			aInCore[(*itNode)->dwNodeId] = 1;
+			for (itIn = (*itNode)->aInputNodesUnique.begin(); itIn != (*itNode)->aInputNodesUnique.end(); itIn++) {
+				aFrontier[itIn->first] = 1;
+			}
+			for (itOut = (*itNode)->aOutputNodes.begin(); itOut != (*itNode)->aOutputNodes.end(); itOut++) {
+				aFrontier[itOut->first] = 1;
+			}
+		}
+		dwCoreSize++;
+		dwJoined += (unsigned int)aJoin.size();
+	}
+	for (i = 0; i < NODE_TYPE_MAX; i++) {
+		dwTotal += aTypeCount[i];
+	}
+	if (dwJoined == dwTotal) {
+		/* nothing left to relax */
+		return;
+	}
+
+	Broker oFork = oSignatureGraph->fork();
+	if (oFork == nullptr) {
+		return;
+	}
+	oCoreGraph = oFork->toSignatureGraph();
+	oCoreGraph->oMatchPlan = nullptr;
+	DFGraph oGraph = oCoreGraph->oGraph;
+	for (it = oGraph->begin(); it != oGraph->end(); it++) {
+		if (!aInCore[it->second->dwNodeId]) {
+			aRemoved.push_back(it->second);
+		}
+	}
+
+	/* cut every input edge entering the core from outside, one wildcard per outside node keeps shared inputs shared */
+	for (i = 0; i < aInCore.size(); i++) {
+		if (!aInCore[i]) {
+			continue;
+		}
+		DFGNode oNode = oGraph->FindNode((unsigned int)i);
+		oGraph->erase(oNode->idx());
+		for (itInput = oNode->aInputNodes.begin(); itInput != oNode->aInputNodes.end(); itInput++) {
+			if (!aInCore[(*itInput)->dwNodeId]) {
+				DFGNode &oWildcard = aWildcards[(*itInput)->dwNodeId];
+				if (oWildcard == nullptr) {
+					oWildcard = oCoreGraph->NewOpaque();
+				}
+				*itInput = oWildcard;
+			}
+		}
+		oNode->aInputNodesUnique.clear();
+		for (itInput = oNode->aInputNodes.begin(); itInput != oNode->aInputNodes.end(); itInput++) {
+			oNode->aInputNodesUnique.insert(std::pair<unsigned int, DFGNode>((*itInput)->dwNodeId, *itInput));
+			(*itInput)->aOutputNodes.insert(std::pair<unsigned int, DFGNode>(oNode->dwNodeId, oNode));
+		}
+		/* the index string follows the inputs */
+		oGraph->insert(std::pair<std::string, DFGNode>(oNode->idx(), oNode));
+	}
+	for (itNode = aRemoved.begin(); itNode != aRemoved.end(); itNode++) {
+		oGraph->RemoveNode(*itNode);
+	}
+
+	oCore = MatchPlan::create(oCoreGraph);
+	oCoreGraph->oMatchPlan = oCore;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "types.hpp"
+#include "DFGNode.hpp" // for node_type_t
+#include "DFGraph.hpp" // for node_fingerprint_t
+
+/* larger signatures are first matched through a core of about SIGNATURE_CORE_NODES rare nodes */
+#define SIGNATURE_CORE_MIN_NODES 64
+#define SIGNATURE_CORE_NODES 24
+
+/* a signature node as seen by the evaluator */
+typedef struct plan_node_t {
+	DFGNode oNode;
+	bool bOrdered;          /* store/load/shift/rotate : inputs match by position */
+	bool bRoot;             /* no outputs, pass 1 starts here */
+	int dwOpaqueRefId;      /* opaque equivalence class, -1 if none */
+	unsigned int dwDegree;  /* number of distinct neighbours */
+	unsigned int dwClassId; /* nodes of equal class have equal pass 1 results, across all plans */
+	node_fingerprint_t stFingerprint; /* lower bound on the neighbourhood of any code node it maps to */
+	unsigned int dwComponentSize; /* lower bound on the size of the code component it maps into */
+} plan_node_t;
+
+/* non-opaque node below a root, at most dwDepth input edges down */
+typedef struct plan_anchor_t {
+	unsigned int dwNodeId;
+	unsigned int dwDepth;
+} plan_anchor_t;
+
+/*
+ * everything the evaluator needs to know about a signature variant,
+ * compiled once when the signatures are loaded and shared read-only by all evaluations
+ */
+class MatchPlanImpl : virtual public ReferenceCounted {
+public:
+	MatchPlanImpl(SignatureBroker &oSignatureGraph);
+
+	/* roots first, then breadth first along the inputs */
+	std::vector<plan_node_t> aNodes;
+	/* signature node id -> index into aNodes, -1 for unused ids */
+	std::vector<int> aNodeIndex;
+	std::vector<unsigned int> aRoots;
+	/* of each root (same order as aRoots), the root itself included if it isn't opaque */
+	std::vector<std::vector<plan_anchor_t>> aAnchors;
+	/* opaque reference id -> signature node ids */
+	std::multimap<int, unsigned int> aOpaqueIdToNode;
+	/* lower bound on the number of code nodes of each type needed for a match */
+	unsigned int aTypeCount[NODE_TYPE_MAX];
+	/* largest number of inputs required of a code node of each type */
+	unsigned int aMaxArity[NODE_TYPE_MAX];
+	/* shifts/rotates by a constant amount, (type << 32 | amount) -> count */
+	std::unordered_map<unsigned long long, unsigned int> aConstantAmounts;
+	/* values of the signature's constants */
+	std::vector<unsigned int> aConstants;
+	unsigned int dwNodeCounter;
+	unsigned int dwLargestComponent;
+	/* opaques are leaves feeding non-opaque nodes only, see DFGraphImpl::Reduce */
+	bool bReducible;
+	/* relaxed subgraph matched ahead of the variant, nullptr if the variant is small enough */
+	SignatureBroker oCoreGraph;
+	MatchPlan oCore;
+
+	/*
+	 * node types the loaded signatures can map onto, the code graphs are reduced accordingly.
+	 * set once by ControlDialog::ConstructSignatures, before any graph is built
+	 */
+	static void SetLoaded(const std::list<SignatureDefinition> &aSignatures);
+	static bool KeepTypes(bool aKeepType[NODE_TYPE_MAX]);
+
+	/* false when oCode provably cannot contain the signature */
+	bool MayMatch(const DFGraph &oCode) const;
+
+	inline const plan_node_t &Node(unsigned int dwNodeId) const { return aNodes[aNodeIndex[dwNodeId]]; }
+	inline bool IsOrdered(unsigned int dwNodeId) const { return aNodes[aNodeIndex[dwNodeId]].bOrdered; }
+
+private:
+	void ComputeAnchors();
+	void Minimize(SignatureBroker &oSignatureGraph);
+	static unsigned int Rarity(const DFGNode &oNode);
+	static unsigned int Classify(const DFGNode &oNode, std::vector<int> &aClassOf);
+};
@@ -1,19 +1,265 @@
+#include <ida.hpp>
+#include <funcs.hpp>
+#include <gdl.hpp>
+#include <bytes.hpp>
 #include <mutex>
+#include <map>
+#include <vector>
+#include <algorithm>
 
+#include "common.hpp"
 #include "PathOracle.hpp"
 #include "Backlog.hpp"
+#include "Processor.hpp"
+#include "DFGraph.hpp"
+#include "ThreadPool.hpp"
+
+typedef std::unordered_map<unsigned long, loop_exit_t> loop_exit_map_t;
 
 std::unordered_map<unsigned long, int> g_aNumForksLeft;
 std::mutex g_stNumForksMutex;
 
+/* function start -> (exiting branch -> loop) */
+std::unordered_map<unsigned long, loop_exit_map_t> g_aLoopExits;
+std::mutex g_stLoopExitsMutex;
+
 void PathOracleImpl::Initialize() {
 	g_aNumForksLeft.clear();
+	g_aLoopExits.clear();
+}
+
+/*
+ * recover natural loops from the CFG of a function, and record each
+ * conditional branch that leaves a loop along with the direction that stays inside
+ */
+static void AnalyzeLoops(unsigned long lpFunctionAddress, loop_exit_map_t &aExits, Processor &oProcessor) {
+	std::vector<std::pair<unsigned long, unsigned long>> aBlocks;
+	std::vector<unsigned long> aLastInstruction;
+	std::vector<std::vector<int>> aSucc, aPred;
+	int i, j, dwNumBlocks;
+
+	API_LOCK();
+	func_t *lpFunction = get_func(lpFunctionAddress);
+	if (lpFunction == NULL) {
+		API_UNLOCK();
+		return;
+	}
+	qflow_chart_t stChart("", lpFunction, lpFunction->start_ea, lpFunction->end_ea, FC_PREDS | FC_NOEXT);
+	dwNumBlocks = stChart.size();
+	aBlocks.resize(dwNumBlocks);
+	aLastInstruction.resize(dwNumBlocks);
+	aSucc.resize(dwNumBlocks);
+	aPred.resize(dwNumBlocks);
+	for (i = 0; i < dwNumBlocks; i++) {
+		aBlocks[i] = std::pair<unsigned long, unsigned long>(stChart.blocks[i].start_ea, stChart.blocks[i].end_ea);
+		aLastInstruction[i] = prev_head(stChart.blocks[i].end_ea, stChart.blocks[i].start_ea);
+		for (j = 0; j < stChart.nsucc(i); j++) {
+			aSucc[i].push_back(stChart.succ(i, j));
+		}
+		for (j = 0; j < stChart.npred(i); j++) {
+			aPred[i].push_back(stChart.pred(i, j));
+		}
+	}
+	API_UNLOCK();
+
+	if (dwNumBlocks == 0) {
+		return;
+	}
+
+	/* iterative DFS from the entry block, an edge to a block still on the stack is a back edge */
+	std::vector<char> aState(dwNumBlocks, 0); // 0 = unvisited, 1 = on stack, 2 = done
+	std::vector<std::pair<int, int>> aStack;
+	std::map<int, std::vector<char>> aLoops; // header -> blocks in loop
+	aStack.push_back(std::pair<int, int>(0, 0));
+	aState[0] = 1;
+	while (!aStack.empty()) {
+		int dwBlock = aStack.back().first;
+		int dwEdge = aStack.back().second++;
+		if (dwEdge >= (int)aSucc[dwBlock].size()) {
+			aState[dwBlock] = 2;
+			aStack.pop_back();
+			continue;
+		}
+		int dwSucc = aSucc[dwBlock][dwEdge];
+		if (aState[dwSucc] == 0) {
+			aState[dwSucc] = 1;
+			aStack.push_back(std::pair<int, int>(dwSucc, 0));
+		} else if (aState[dwSucc] == 1) {
+			/* back edge dwBlock -> dwSucc, body is everything reaching dwBlock without passing the header */
+			std::vector<char> &aBody = aLoops[dwSucc];
+			std::vector<int> aWork;
+			if (aBody.empty()) {
+				aBody.resize(dwNumBlocks, 0);
+				aBody[dwSucc] = 1;
+			}
+			if (!aBody[dwBlock]) {
+				aBody[dwBlock] = 1;
+				aWork.push_back(dwBlock);
+			}
+			while (!aWork.empty()) {
+				int dwCurrent = aWork.back();
+				aWork.pop_back();
+				for (int dwPred : aPred[dwCurrent]) {
+					if (!aBody[dwPred]) {
+						aBody[dwPred] = 1;
+						aWork.push_back(dwPred);
+					}
+				}
+			}
+		}
+	}
+
+	/* visit loops innermost first, so a branch is attributed to the smallest loop it exits */
+	std::vector<std::pair<int, int>> aOrder;
+	for (std::map<int, std::vector<char>>::iterator it = aLoops.begin(); it != aLoops.end(); ++it) {
+		aOrder.push_back(std::pair<int, int>((int)std::count(it->second.begin(), it->second.end(), 1), it->first));
+	}
+	std::sort(aOrder.begin(), aOrder.end());
+
+	for (std::pair<int, int> &stLoop : aOrder) {
+		int dwHeader = stLoop.second;
+		std::vector<char> &aBody = aLoops[dwHeader];
+		loop_exit_t stTemplate;
+
+		stTemplate.lpHeader = aBlocks[dwHeader].first;
+		stTemplate.stPreheader = std::pair<unsigned long, unsigned long>(0, 0);
+		for (int dwPred : aPred[dwHeader]) {
+			if (!aBody[dwPred]) {
+				if (stTemplate.stPreheader.second != 0) {
+					/* multiple entries */
+					stTemplate.stPreheader = std::pair<unsigned long, unsigned long>(0, 0);
+					break;
+				}
+				stTemplate.stPreheader = aBlocks[dwPred];
+			}
+		}
+		std::vector<int> aBodyIndex(dwNumBlocks, -1);
+		for (i = 0; i < dwNumBlocks; i++) {
+			if (aBody[i]) {
+				aBodyIndex[i] = (int)stTemplate.aBody.size();
+				stTemplate.aBody.push_back(aBlocks[i]);
+			}
+		}
+		stTemplate.aBodySucc.resize(stTemplate.aBody.size());
+		for (i = 0; i < dwNumBlocks; i++) {
+			for (int dwSucc : aSucc[i]) {
+				if (aBody[i] && aBody[dwSucc]) {
+					stTemplate.aBodySucc[aBodyIndex[i]].push_back(aBodyIndex[dwSucc]);
+				}
+			}
+		}
+
+		for (i = 0; i < dwNumBlocks; i++) {
+			if (!aBody[i] || aSucc[i].size() != 2 || aExits.find(aLastInstruction[i]) != aExits.end()) {
+				continue;
+			}
+			int dwFallthrough = aBlocks[aSucc[i][0]].first == aBlocks[i].second ? 0 : 1;
+			int dwTaken = 1 - dwFallthrough;
+			if (aBlocks[aSucc[i][dwFallthrough]].first != aBlocks[i].second || aSucc[i][0] == aSucc[i][1]) {
+				continue;
+			}
+			if (aBody[aSucc[i][dwTaken]] == aBody[aSucc[i][dwFallthrough]]) {
+				/* both directions stay inside (or leave) this loop */
+				continue;
+			}
+			loop_exit_t stExit(stTemplate);
+			stExit.lpBranch = aLastInstruction[i];
+			/* the condition holds when the branch is taken */
+			stExit.bStayOnTrue = !!aBody[aSucc[i][dwTaken]];
+			stExit.dwTripCount = 0;
+			oProcessor->SummarizeLoop(stExit);
+			wc_debug("[*] loop @ 0x%lx exits through 0x%lx, trip count %u\n", stExit.lpHeader, stExit.lpBranch, stExit.dwTripCount);
+			aExits.insert(std::pair<unsigned long, loop_exit_t>(stExit.lpBranch, stExit));
+		}
+	}
+}
+
+/* loop left by the branch at lpAddress, if any, analyzing the function holding it if needed */
+static const loop_exit_t *LoadLoopExit(unsigned long lpAddress, Processor &oProcessor) {
+	unsigned long lpFunctionStart;
+	std::unordered_map<unsigned long, loop_exit_map_t>::iterator it;
+	loop_exit_map_t::iterator it2;
+
+	API_LOCK();
+	func_t *lpFunction = get_func(lpAddress);
+	lpFunctionStart = lpFunction != NULL ? lpFunction->start_ea : 0;
+	API_UNLOCK();
+	if (lpFunction == NULL) {
+		return nullptr;
+	}
+
+	std::unique_lock<std::mutex> mLock(g_stLoopExitsMutex);
+	it = g_aLoopExits.find(lpFunctionStart);
+	if (it == g_aLoopExits.end()) {
+		/*
+		 * analyzed without the lock, other paths keep going meanwhile.
+		 * should two of them race on the same function, the first result is kept
+		 */
+		loop_exit_map_t aExits;
+		mLock.unlock();
+		AnalyzeLoops(lpFunctionStart, aExits, oProcessor);
+		mLock.lock();
+		it = g_aLoopExits.insert(std::pair<unsigned long, loop_exit_map_t>(lpFunctionStart, aExits)).first;
+	}
+	it2 = it->second.find(lpAddress);
+	if (it2 == it->second.end()) {
+		return nullptr;
+	}
+	return &it2->second;
 }
 
-fork_policy_t PathOracleImpl::ShouldFork(BacklogDb &oBacklog, unsigned long lpAddress) {
+/*
+ * answers are kept per branch, so the paths of a function only look up the function holding
+ * a branch (and wait on g_stLoopExitsMutex) the first time one of them reaches it.
+ * the loop exits pointed to are never modified nor freed until the next Initialize
+ */
+const loop_exit_t *PathOracleImpl::FindLoopExit(unsigned long lpAddress, Processor &oProcessor) {
+	std::unordered_map<unsigned long, const loop_exit_t *>::iterator it;
+	const loop_exit_t *lpLoop;
+
+	{
+		std::unique_lock<std::mutex> mLock(stLoopExitMutex);
+		it = aLoopExits.find(lpAddress);
+		if (it != aLoopExits.end()) {
+			return it->second;
+		}
+	}
+	lpLoop = LoadLoopExit(lpAddress, oProcessor);
+	std::unique_lock<std::mutex> mLock(stLoopExitMutex);
+	aLoopExits.insert(std::pair<unsigned long, const loop_exit_t *>(lpAddress, lpLoop));
+	return lpLoop;
+}
+
+fork_policy_t PathOracleImpl::ShouldFork(BacklogDb &oBacklog, unsigned long lpAddress, Processor &oProcessor, bool bMayFork) {
+	const loop_exit_t *lpLoop = FindLoopExit(lpAddress, oProcessor);
+	if (lpLoop != nullptr) {
+		/*
+		 * branch leaving a loop -> don't fork, stay in the loop for as many
+		 * iterations as the trip count says (bounded when unknown), then leave
+		 */
+		unsigned int dwStays = 0, dwMaxStays;
+		Backlog oLog = oBacklog->GetLog(lpAddress);
+		if (oLog != nullptr) {
+			for (BacklogImpl::reverse_iterator it = oLog->rbegin(); it != oLog->rend() && *it == lpLoop->bStayOnTrue; ++it) {
+				dwStays++;
+			}
+		}
+		if (lpLoop->dwTripCount != 0 && lpLoop->dwTripCount <= (unsigned int)MaxLoopUnroll()) {
+			dwMaxStays = lpLoop->dwTripCount - 1;
+		} else {
+			dwMaxStays = MaxLoopIterations();
+		}
+		return ((dwStays < dwMaxStays) == lpLoop->bStayOnTrue) ? FORK_POLICY_TAKE_TRUE : FORK_POLICY_TAKE_FALSE;
+	}
+
 	if (!oBacklog->Exists(lpAddress)) {
 		/* first time -> fork */
 		std::unordered_map<unsigned long, int>::iterator it;
+		if (!bMayFork) {
+			/* the false branch is dropped, not deferred */
+			wc_debug("[*] memory budget exhausted, not forking @ 0x%lx\n", lpAddress);
+			return FORK_POLICY_TAKE_TRUE;
+		}
 		std::unique_lock<std::mutex> mLock(g_stNumForksMutex);
 
 		/* look up per-function metadata (currently only holds num forks left per function) */
@@ -41,6 +287,29 @@ fork_policy_t PathOracleImpl::ShouldFork(BacklogDb &oBacklog, unsigned long lpAd
 	}
 }
 
+/*
+ * score of a forked path for the scheduler, higher runs first:
+ * favor paths whose graph so far looks like crypto (xor/rotate/shift/and/or/add heavy),
+ * that contribute many nodes per instruction, and that are not deep in a fork chain
+ */
+double PathOracleImpl::PathPriority(unsigned int dwForkDepth, unsigned int dwNumInstructions, DFGraph &oGraph) {
+	unsigned int dwNumNodes = (unsigned int)oGraph->size();
+	unsigned int dwNumCrypto =
+		oGraph->aNodeTypeCount[NODE_TYPE_XOR] +
+		oGraph->aNodeTypeCount[NODE_TYPE_ROTATE] +
+		oGraph->aNodeTypeCount[NODE_TYPE_SHIFT] +
+		oGraph->aNodeTypeCount[NODE_TYPE_AND] +
+		oGraph->aNodeTypeCount[NODE_TYPE_OR] +
+		oGraph->aNodeTypeCount[NODE_TYPE_ADD];
+	double dCryptoLikeness = dwNumNodes == 0 ? 0 : (double)dwNumCrypto / dwNumNodes;
+	double dGrowthRate = dwNumInstructions == 0 ? 0 : (double)dwNumNodes / dwNumInstructions;
+
+	if (dGrowthRate > 4) {
+		dGrowthRate = 4;
+	}
+	return (1 + 2 * dCryptoLikeness) * (0.5 + dGrowthRate / 8) / (1 + 0.25 * dwForkDepth);
+}
+
 int PathOracleImpl::MaxCallDepth() {
 	return 2; // inline functions 2 levels deep
 }
@@ -61,6 +330,30 @@ int PathOracleImpl::MaxConditions() {
 	return 1000;
 }
 
+int PathOracleImpl::MaxLoopIterations() {
+	return 4; // loops with unknown trip count are lifted 5 times
+}
+
+int PathOracleImpl::MaxLoopUnroll() {
+	return 80; // loops with a known trip count up to 80 (e.g. SHA-1 rounds) are lifted completely
+}
+
+int PathOracleImpl::IncrementalEvaluationInterval() {
+	/*
+	 * optional : when non zero, the graph under construction is also evaluated
+	 * once it reaches that many nodes, then twice as many, and so on (see CodeBrokerImpl::YieldCheckpoint)
+	 */
+	return 0;
+}
+
 int PathOracleImpl::MaxEvaluationTime() {
 	return 10000; // 10s
 }
+
+bool PathOracleImpl::CancelOnFirstMatch() {
+	return true; // once a path of a function matches, its remaining paths are not needed
+}
+
+size_t PathOracleImpl::MaxMemoryUsage() {
+	return (size_t)1 << 30; // 1GB worth of graphs alive, beyond that no new functions are started and forks are declined
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
 #include "types.hpp"
 
 typedef enum {
@@ -8,6 +12,20 @@ typedef enum {
 	FORK_POLICY_TAKE_BOTH
 } fork_policy_t;
 
+/*
+ * conditional branch that leaves a natural loop,
+ * as recovered from the function's control flow graph
+ */
+typedef struct loop_exit_t {
+	unsigned long lpHeader;           /* first instruction of the loop header */
+	unsigned long lpBranch;           /* the exiting conditional branch */
+	std::pair<unsigned long, unsigned long> stPreheader; /* [start, end) of the unique block entering the loop, (0, 0) if none */
+	bool bStayOnTrue;                 /* decision that keeps execution inside the loop */
+	unsigned int dwTripCount;         /* number of times the branch is reached until it exits, 0 if unknown */
+	std::vector<std::pair<unsigned long, unsigned long>> aBody; /* [start, end) of each block in the loop */
+	std::vector<std::vector<int>> aBodySucc; /* successors of each block of aBody, as indices into aBody, exits omitted */
+} loop_exit_t;
+
 class PathOracleImpl: virtual public ReferenceCounted {
 public:
 	static void Initialize();
@@ -16,11 +34,25 @@ public:
 	inline ~PathOracleImpl() { }
 
 	unsigned long lpFunctionAddress;
-	fork_policy_t ShouldFork(BacklogDb &oBacklog, unsigned long lpAddress);
+	/* bMayFork false : over the memory budget, never answers TAKE_BOTH nor spends the function's forks */
+	fork_policy_t ShouldFork(BacklogDb &oBacklog, unsigned long lpAddress, Processor &oProcessor, bool bMayFork = true);
 	int MaxCallDepth();
 	int MaxGraphSize();
 	int MaxConsecutiveNoopInstructions();
 	int MaxConstructionTime();
 	int MaxConditions();
+	int MaxLoopIterations();
+	int MaxLoopUnroll();
+	int IncrementalEvaluationInterval();
+	double PathPriority(unsigned int dwForkDepth, unsigned int dwNumInstructions, DFGraph &oGraph);
 	static int MaxEvaluationTime();
-};
\ No newline at end of file
+	static bool CancelOnFirstMatch();
+	static size_t MaxMemoryUsage();
+
+private:
+	const loop_exit_t *FindLoopExit(unsigned long lpAddress, Processor &oProcessor);
+
+	/* conditional branch -> loop it exits, nullptr if none (see FindLoopExit) */
+	std::unordered_map<unsigned long, const loop_exit_t *> aLoopExits;
+	std::mutex stLoopExitMutex;
+};
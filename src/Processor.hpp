@@ -9,6 +9,8 @@ typedef enum {
 	//PROCESSOR_STATUS_BRANCH
 } processor_status_t;
 
+struct loop_exit_t;
+
 class ProcessorImpl: virtual public ReferenceCounted {
 public:
 	inline ProcessorImpl() { }
@@ -17,6 +19,8 @@ public:
 	virtual void initialize(CodeBroker &oBuilder) = 0;
 	virtual processor_status_t instruction(CodeBroker &oBuilder, unsigned long *lpNextAddress, unsigned long lpAddress) = 0;
 	virtual bool ShouldClean(DFGNode &oNode) = 0;
+	/* fill in the trip count of a loop if it can be derived from the code, returns false otherwise */
+	virtual bool SummarizeLoop(loop_exit_t &stLoop) { return false; }
 protected:
 	virtual Processor Migrate(DFGraph oGraph) = 0;
 
@@ -1,6 +1,7 @@
 #include <idp.hpp>
 #include <Windows.h>
 #include <sstream>
+#include <algorithm>
 
 #include "common.hpp"
 #include "SignatureEvaluator.hpp"
@@ -8,6 +9,7 @@
 #include "DFGraph.hpp"
 #include "DFGNode.hpp"
 #include "Predicate.hpp"
+#include "MatchPlan.hpp"
 
 inline opaque_node_assign_t OpaqueAssignmentImpl::Assign(DFGNode oSignatureNode, DFGNode oCandidate) {
 	if (NODE_IS_OPAQUE(oSignatureNode)) {
@@ -49,22 +51,20 @@ inline void OpaqueAssignmentImpl::Unassign(DFGNode oSignatureNode) {
 		}
 	}
 }
+/*
+ * choice points of pass 2 : instead of copying oMatrix,
+ * the matrix keeps a trail of overwritten cells to roll back
+ */
 void SignatureEvaluatorImpl::PushMatrix() {
-	aStack.push_back(oMatrix);
-	oMatrix = oMatrix->copy();
+	oMatrix->Mark();
 }
 
 void SignatureEvaluatorImpl::PopMatrix() {
-	if (aStack.begin() != aStack.end()) {
-		oMatrix = aStack.back();
-		aStack.pop_back();
-	}
+	oMatrix->Undo();
 }
 
 void SignatureEvaluatorImpl::ClearFlagged() {
-	if (aStack.begin() != aStack.end()) {
-		aStack.pop_back();
-	}
+	oMatrix->Commit();
 }
 
 assignment_t SignatureEvaluatorImpl::Pass1Recurse(const DFGNode& oSignatureNode, const DFGNode& oCodeNode) {
@@ -75,16 +75,20 @@ assignment_t SignatureEvaluatorImpl::Pass1Recurse(const DFGNode& oSignatureNode,
 			std::list<DFGNode>::const_iterator itOrderE, itOrderC;
 			assignment_t eResult(ASSIGNMENT_UNDEFINED);
 
-			if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime) {
+			if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime || Cancelled()) {
 				return ASSIGNMENT_INVALID;
 			}
-
-			if (
-				!NODE_IS_STORE(oSignatureNode) &&
-				!NODE_IS_LOAD(oSignatureNode) &&
-				!NODE_IS_SHIFT(oSignatureNode) &&
-				!NODE_IS_ROTATE(oSignatureNode)
+			if (oVerdicts != nullptr && oMatchGraph->HasTypeIndex() && oVerdicts->Contains(VerdictKey(
+					oPlan->Node(oSignatureNode->dwNodeId).dwClassId,
+					oMatchGraph->ConeHash(oCodeNode->dwNodeId)
+				), dwVerdictSnapshot)
 			) {
+				/* failed on a sibling path, below an identical input cone */
+				oMatrix->Assign(oSignatureNode->dwNodeId, oCodeNode->dwNodeId, ASSIGNMENT_INVALID);
+				return ASSIGNMENT_INVALID;
+			}
+
+			if (!oPlan->IsOrdered(oSignatureNode->dwNodeId)) {
 				/*
 				 * order of input nodes is not important
 				 * (forall S : exists V)
@@ -122,10 +126,16 @@ assignment_t SignatureEvaluatorImpl::Pass1Recurse(const DFGNode& oSignatureNode,
 					}
 				}
 			}
-			oMatrix->Assign(oSignatureNode->dwNodeId, oCodeNode->dwNodeId, eResult, true);
+			oMatrix->Assign(oSignatureNode->dwNodeId, oCodeNode->dwNodeId, eResult);
+			if (eResult == ASSIGNMENT_INVALID && oMatchGraph->HasTypeIndex()) {
+				aPendingVerdicts.push_back(VerdictKey(
+					oPlan->Node(oSignatureNode->dwNodeId).dwClassId,
+					oMatchGraph->ConeHash(oCodeNode->dwNodeId)
+				));
+			}
 			return eResult;
 		} else {
-			oMatrix->Assign(oSignatureNode->dwNodeId, oCodeNode->dwNodeId, ASSIGNMENT_INVALID, true);
+			oMatrix->Assign(oSignatureNode->dwNodeId, oCodeNode->dwNodeId, ASSIGNMENT_INVALID);
 			return ASSIGNMENT_INVALID;
 		}
 	} else {
@@ -133,124 +143,213 @@ assignment_t SignatureEvaluatorImpl::Pass1Recurse(const DFGNode& oSignatureNode,
 	}
 }
 
-bool SignatureEvaluatorImpl::PruneFlagged() {
-	DFGraphImpl::const_iterator itP;
-	bool bAgain;
+/*
+ * (oSignatureNode, oCodeNode) is supported when each neighbour of oSignatureNode
+ * still has a candidate among the neighbours of oCodeNode
+ */
+bool SignatureEvaluatorImpl::IsSupported(const DFGNode &oSignatureNode, const DFGNode &oCodeNode) {
+	std::list<DFGNode>::const_iterator itOrderEN;
+	std::list<DFGNode>::const_iterator itOrderCN;
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itEN, itCN;
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itOutEN, itOutCN;
 
-	do {
-		bAgain = false;
-		for (itP = oSignatureGraph->oGraph->begin(); itP != oSignatureGraph->oGraph->end(); itP++) {
-			DFGNode oSignatureNode = itP->second;
-			sparse_matrix_iterator_t itCodeNode = oMatrix->FirstCandidate(oSignatureNode->dwNodeId);
-
-			/*
-			 * no candiate for this node exists -> bail
-			 */
-			if (itCodeNode.dwCodeNodeId == 0xffffffff) {
+	if (oPlan->IsOrdered(oSignatureNode->dwNodeId)) {
+		if (oSignatureNode->aInputNodes.size() != oCodeNode->aInputNodes.size()) {
+			return false;
+		}
+		for (
+			itOrderEN = oSignatureNode->aInputNodes.begin(), itOrderCN = oCodeNode->aInputNodes.begin();
+			itOrderEN != oSignatureNode->aInputNodes.end();
+			itOrderEN++, itOrderCN++
+		) {
+			assignment_t eAssignment = oMatrix->GetAssignment((*itOrderEN)->dwNodeId, (*itOrderCN)->dwNodeId);
+			if (!(eAssignment == ASSIGNMENT_VALID || eAssignment == ASSIGNMENT_UNDEFINED)) {
 				return false;
 			}
-
-			while (itCodeNode.dwCodeNodeId != 0xffffffff) {
-				/* lookup object for candidate node id since as we need it to lookup its inputs */
-				DFGNode oCodeNode = oCodeGraph->oGraph->FindNode(itCodeNode.dwCodeNodeId);
-				std::list<DFGNode>::const_iterator itOrderEN;
-				std::list<DFGNode>::const_iterator itOrderCN;
-				std::unordered_map<unsigned int, DFGNode>::const_iterator itEN, itCN;
-				std::unordered_map<unsigned int, DFGNode>::const_iterator itOutEN, itOutCN;
-
-				if (
-					/* the following node types are sensitive to input order */
-					NODE_IS_STORE(oSignatureNode) ||
-					NODE_IS_LOAD(oSignatureNode) ||
-					NODE_IS_SHIFT(oSignatureNode) ||
-					NODE_IS_ROTATE(oSignatureNode)
-				) {
-					if (oSignatureNode->aInputNodes.size() != oCodeNode->aInputNodes.size()) {
-						goto _invalid;
-					}
-					for (
-						itOrderEN = oSignatureNode->aInputNodes.begin(), itOrderCN = oCodeNode->aInputNodes.begin();
-						itOrderEN != oSignatureNode->aInputNodes.end();
-						itOrderEN++, itOrderCN++
-					) {
-						assignment_t eAssignment = oMatrix->GetAssignment((*itOrderEN)->dwNodeId, (*itOrderCN)->dwNodeId);
-						if (eAssignment == ASSIGNMENT_VALID || eAssignment == ASSIGNMENT_UNDEFINED) {
-							continue;
-						}
-						goto _invalid;
-					}
-				} else {
-					/* input order agnostic node */
-					if (oSignatureNode->aInputNodesUnique.size() > oCodeNode->aInputNodesUnique.size()) {
-						goto _invalid;
-					}
-					for (itEN = oSignatureNode->aInputNodesUnique.begin();
-						itEN != oSignatureNode->aInputNodesUnique.end();
-						itEN++
-					) {
-						for (itCN = oCodeNode->aInputNodesUnique.begin(); itCN != oCodeNode->aInputNodesUnique.end(); itCN++) {
-							assignment_t eAssignment = oMatrix->GetAssignment(itEN->first, itCN->first);
-							if (eAssignment == ASSIGNMENT_VALID || eAssignment == ASSIGNMENT_UNDEFINED) {
-								break;
-							}
-						}
-						if (itCN == oCodeNode->aInputNodesUnique.end()) {
-							goto _invalid;
-						}
-					}
+		}
+	} else {
+		/* input order agnostic node */
+		if (oSignatureNode->aInputNodesUnique.size() > oCodeNode->aInputNodesUnique.size()) {
+			return false;
+		}
+		for (itEN = oSignatureNode->aInputNodesUnique.begin(); itEN != oSignatureNode->aInputNodesUnique.end(); itEN++) {
+			for (itCN = oCodeNode->aInputNodesUnique.begin(); itCN != oCodeNode->aInputNodesUnique.end(); itCN++) {
+				assignment_t eAssignment = oMatrix->GetAssignment(itEN->first, itCN->first);
+				if (eAssignment == ASSIGNMENT_VALID || eAssignment == ASSIGNMENT_UNDEFINED) {
+					break;
 				}
+			}
+			if (itCN == oCodeNode->aInputNodesUnique.end()) {
+				return false;
+			}
+		}
+	}
 
-				if (false) { _invalid:
-					oMatrix->Assign(oSignatureNode->dwNodeId, oCodeNode->dwNodeId, ASSIGNMENT_INVALID);
-					bAgain = true;
-					goto _continue;
-				}
+	for (itOutEN = oSignatureNode->aOutputNodes.begin(); itOutEN != oSignatureNode->aOutputNodes.end(); itOutEN++) {
+		for (itOutCN = oCodeNode->aOutputNodes.begin(); itOutCN != oCodeNode->aOutputNodes.end(); itOutCN++) {
+			assignment_t eAssignment = oMatrix->GetAssignment(itOutEN->first, itOutCN->first);
+			if (eAssignment == ASSIGNMENT_VALID || eAssignment == ASSIGNMENT_UNDEFINED) {
+				break;
+			}
+		}
+		if (itOutCN == oCodeNode->aOutputNodes.end()) {
+			return false;
+		}
+	}
+	return true;
+}
 
-				for (itOutEN = oSignatureNode->aOutputNodes.begin(); itOutEN != oSignatureNode->aOutputNodes.end(); itOutEN++) {
-					for (itOutCN = oCodeNode->aOutputNodes.begin(); itOutCN != oCodeNode->aOutputNodes.end(); itOutCN++) {
-						assignment_t eAssignment = oMatrix->GetAssignment(itOutEN->first, itOutCN->first);
-						if (eAssignment == ASSIGNMENT_VALID || eAssignment == ASSIGNMENT_UNDEFINED) {
-							break;
+/* removes a candidate, its neighbours are revisited by the next PruneFlagged */
+void SignatureEvaluatorImpl::Invalidate(unsigned int dwSignatureNodeId, unsigned int dwCodeNodeId) {
+	oMatrix->Assign(dwSignatureNodeId, dwCodeNodeId, ASSIGNMENT_INVALID);
+	aRemoved.push_back(sparse_matrix_iterator_t(dwSignatureNodeId, dwCodeNodeId));
+}
+
+/*
+ * initial sweep over all candidates, afterwards only
+ * the neighbourhood of removed candidates needs to be looked at
+ */
+bool SignatureEvaluatorImpl::PruneAll() {
+	std::vector<plan_node_t>::const_iterator itP;
+
+	aRemoved.clear();
+	for (itP = oPlan->aNodes.begin(); itP != oPlan->aNodes.end(); itP++) {
+		sparse_matrix_iterator_t itCodeNode = oMatrix->FirstCandidate(itP->oNode->dwNodeId);
+
+		/*
+		 * no candiate for this node exists -> bail
+		 */
+		if (itCodeNode.dwCodeNodeId == 0xffffffff) {
+			return false;
+		}
+		while (itCodeNode.dwCodeNodeId != 0xffffffff) {
+			if (!IsSupported(itP->oNode, oMatchGraph->FindNode(itCodeNode.dwCodeNodeId))) {
+				Invalidate(itP->oNode->dwNodeId, itCodeNode.dwCodeNodeId);
+			}
+			itCodeNode = oMatrix->NextCandidate(itCodeNode);
+		}
+		if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime || Cancelled()) {
+			aRemoved.clear();
+			return false;
+		}
+	}
+	return PruneFlagged();
+}
+
+/*
+ * arc consistency : a removed candidate (S, C) can only take away the support of
+ * candidates (S', C') with S' a neighbour of S and C' a neighbour of C,
+ * so only those are re-checked, until no more candidates are removed
+ */
+bool SignatureEvaluatorImpl::PruneFlagged() {
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itSN, itCN;
+	unsigned int dwNumChecks = 0;
+	int i, j;
+
+	while (aRemoved.begin() != aRemoved.end()) {
+		sparse_matrix_iterator_t stRemoved = aRemoved.back();
+		aRemoved.pop_back();
+
+		if (oMatrix->FirstCandidate(stRemoved.dwSignatureNodeId).dwCodeNodeId == 0xffffffff) {
+			/* no candidate left for this node -> bail */
+			aRemoved.clear();
+			return false;
+		}
+
+		DFGNode oSignatureNode = oSignatureGraph->oGraph->FindNode(stRemoved.dwSignatureNodeId);
+		DFGNode oCodeNode = oMatchGraph->FindNode(stRemoved.dwCodeNodeId);
+		/* neighbours are inputs and outputs */
+		const std::unordered_map<unsigned int, DFGNode> *aSignatureNeighbours[2] = {
+			&oSignatureNode->aInputNodesUnique, &oSignatureNode->aOutputNodes
+		};
+		const std::unordered_map<unsigned int, DFGNode> *aCodeNeighbours[2] = {
+			&oCodeNode->aInputNodesUnique, &oCodeNode->aOutputNodes
+		};
+
+		for (i = 0; i < 2; i++) {
+			for (itSN = aSignatureNeighbours[i]->begin(); itSN != aSignatureNeighbours[i]->end(); itSN++) {
+				for (j = 0; j < 2; j++) {
+					for (itCN = aCodeNeighbours[j]->begin(); itCN != aCodeNeighbours[j]->end(); itCN++) {
+						assignment_t eAssignment = oMatrix->GetAssignment(itSN->first, itCN->first);
+						if (!(eAssignment == ASSIGNMENT_VALID || eAssignment == ASSIGNMENT_UNDEFINED)) {
+							continue;
+						}
+						if (!IsSupported(itSN->second, itCN->second)) {
+							Invalidate(itSN->first, itCN->first);
 						}
 					}
-					if (itOutCN == oCodeNode->aOutputNodes.end()) {
-						goto _invalid;
-					}
-				}
-
-_continue:
-				itCodeNode = oMatrix->NextCandidate(itCodeNode);
-				if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime) {
-					return false;
 				}
 			}
 		}
-	} while (bAgain);
 
+		if ((++dwNumChecks & 0xff) == 0 && Aborted()) {
+			aRemoved.clear();
+			return false;
+		}
+	}
 	return true;
 }
 
-bool SignatureEvaluatorImpl::Pass2Recurse(
-	FlagMap oFlagMap,
-	DFGraphImpl::const_iterator itE
-) {
-	if (itE == oSignatureGraph->oGraph->end()) {
-		DFGraphImpl::const_iterator itP;
+/*
+ * next signature node to decide : the one with fewest candidates left,
+ * ties going to the node with most decided neighbours.
+ * nullptr once all nodes are decided
+ */
+DFGNode SignatureEvaluatorImpl::SelectNode() {
+	std::vector<plan_node_t>::const_iterator it;
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itN;
+	DFGNode oBest;
+	unsigned int dwBestCount = 0xffffffff, dwBestConnected = 0;
+
+	for (it = oPlan->aNodes.begin(); it != oPlan->aNodes.end(); it++) {
+		if (aSelected[it->oNode->dwNodeId]) {
+			continue;
+		}
+		/* no need to count beyond the best so far, except to break ties */
+		unsigned int dwCount = oMatrix->CountCandidates(it->oNode->dwNodeId, dwBestCount == 0xffffffff ? dwBestCount : dwBestCount + 1);
+		if (dwCount > dwBestCount) {
+			continue;
+		}
+		if (dwCount == 0) {
+			/* dead end, fail right away */
+			return it->oNode;
+		}
+		unsigned int dwConnected = 0;
+		for (itN = it->oNode->aInputNodesUnique.begin(); itN != it->oNode->aInputNodesUnique.end(); itN++) {
+			dwConnected += aSelected[itN->first];
+		}
+		for (itN = it->oNode->aOutputNodes.begin(); itN != it->oNode->aOutputNodes.end(); itN++) {
+			dwConnected += aSelected[itN->first];
+		}
+		if (dwCount < dwBestCount || dwConnected > dwBestConnected) {
+			oBest = it->oNode;
+			dwBestCount = dwCount;
+			dwBestConnected = dwConnected;
+		}
+	}
+	return oBest;
+}
+
+bool SignatureEvaluatorImpl::Pass2Recurse(FlagMap oFlagMap) {
+	DFGNode oSignatureNode = SelectNode();
+
+	if (oSignatureNode == nullptr) {
+		std::vector<plan_node_t>::const_iterator itP;
 		/*
 		 * test for isomorphism
 		 */
 		oMapping->clear();
 
-		for (itP = oSignatureGraph->oGraph->begin(); itP != oSignatureGraph->oGraph->end(); itP++) {
+		for (itP = oPlan->aNodes.begin(); itP != oPlan->aNodes.end(); itP++) {
 			/*
 			 * go through all nodes in the expression
 			 */
-			DFGNode oSignatureNode = itP->second;
+			DFGNode oSignatureNode = itP->oNode;
 			sparse_matrix_iterator_t itCodeNode = oMatrix->FirstCandidate(oSignatureNode->dwNodeId);
 			if (itCodeNode.dwCodeNodeId == 0xffffffff) {
 				return false;
 			}
-			DFGNode oCodeNode = oCodeGraph->oGraph->FindNode(itCodeNode.dwCodeNodeId);
+			DFGNode oCodeNode = oMatchGraph->FindNode(itCodeNode.dwCodeNodeId);
 			/*
 			 * oSignatureNode maps to oCodeNode
 			 * below we check for every intput E to eSignatureNode,
@@ -261,13 +360,7 @@ bool SignatureEvaluatorImpl::Pass2Recurse(
 			std::unordered_map<unsigned int, DFGNode>::const_iterator itEN;
 			std::unordered_map<unsigned int, DFGNode>::const_iterator itCN;
 
-			if (
-				/* the following node types are sensitive to input order */
-				NODE_IS_STORE(oSignatureNode) ||
-				NODE_IS_LOAD(oSignatureNode) ||
-				NODE_IS_SHIFT(oSignatureNode) ||
-				NODE_IS_ROTATE(oSignatureNode)
-			) {
+			if (oPlan->IsOrdered(oSignatureNode->dwNodeId)) {
 				for (
 					itOrderEN = oSignatureNode->aInputNodes.begin(), itOrderCN = oCodeNode->aInputNodes.begin();
 					itOrderEN != oSignatureNode->aInputNodes.end();
@@ -299,234 +392,639 @@ bool SignatureEvaluatorImpl::Pass2Recurse(
 			oMapping->Assign(oSignatureNode, oCodeNode);
 		}
 		return true;
-	} else {
-		DFGNode oSignatureNode = itE->second;
+	}
+
+	aSelected[oSignatureNode->dwNodeId] = 1;
+	if (Pass2Assign(oFlagMap, oSignatureNode)) {
+		return true;
+	}
+	aSelected[oSignatureNode->dwNodeId] = 0;
+	return false;
+}
 
-		// only explore if the nodes are candidates for matching and the
-		// column has not been assigned yet.
-		sparse_matrix_iterator_t it = oMatrix->FirstCandidate(oSignatureNode->dwNodeId);
-		if (it.dwCodeNodeId == 0xffffffff) {
-			/* this node has no candidate */
+bool SignatureEvaluatorImpl::Pass2Assign(FlagMap oFlagMap, DFGNode &oSignatureNode) {
+	// only explore if the nodes are candidates for matching and the
+	// column has not been assigned yet.
+	sparse_matrix_iterator_t it = oMatrix->FirstCandidate(oSignatureNode->dwNodeId);
+	if (it.dwCodeNodeId == 0xffffffff) {
+		/* this node has no candidate */
+		return false;
+	}
+	if (oMatrix->NextCandidate(it).dwCodeNodeId == 0xffffffff) {
+		/*
+		 * single candidate, may not need to push oSparseMatrix and prune
+		 * thus, we differentiate between the two
+		 */
+		if (oFlagMap->IsAssigned(it.dwCodeNodeId)) {
+			/* candidate is already assigned to a different signature node */
 			return false;
 		}
-		if (oMatrix->NextCandidate(it).dwCodeNodeId == 0xffffffff) {
+		opaque_node_assign_t eAssignStatus = OPAQUE_NODE_ASSIGN_ALREADY_SET;
+		if (NODE_IS_OPAQUE(oSignatureNode) &&
+			(eAssignStatus = oOpaqueAssignment->Assign(
+				oSignatureNode,
+				oMatchGraph->FindNode(it.dwCodeNodeId)
+			)) == OPAQUE_NODE_ASSIGN_NOK
+		) {
 			/*
-			 * single candidate, may not need to push oSparseMatrix and prune
-			 * thus, we differentiate between the two
+			 * Signature node type is opaque,
+			 * but currently assigned to a different node type
 			 */
-			if (oFlagMap->IsAssigned(it.dwCodeNodeId)) {
-				/* candidate is already assigned to a different signature node */
-				return false;
-			}
-			opaque_node_assign_t eAssignStatus = OPAQUE_NODE_ASSIGN_ALREADY_SET;
-			if (NODE_IS_OPAQUE(oSignatureNode) &&
-				(eAssignStatus = oOpaqueAssignment->Assign(
-					oSignatureNode,
-					oCodeGraph->oGraph->FindNode(it.dwCodeNodeId)
-				)) == OPAQUE_NODE_ASSIGN_NOK
-			) {
-				/*
-				 * Signature node type is opaque,
-				 * but currently assigned to a different node type
-				 */
-				return false;
-			} else if (eAssignStatus == OPAQUE_NODE_ASSIGN_OK) {
-				/*
-				 * Opaque signature node type has just been assigned,
-				 * below we invalidate all candidates for the same opaque type ref but a different type
-				 */
-				PushMatrix();
-				int dwOpaqueRefId = oSignatureNode->toOpaque()->dwOpaqueRefId;
-				node_type_spec_t oSpec = (*oOpaqueAssignment)[dwOpaqueRefId];
-				std::multimap<int, unsigned int>::iterator itOpaque;
+			return false;
+		} else if (eAssignStatus == OPAQUE_NODE_ASSIGN_OK) {
+			/*
+			 * Opaque signature node type has just been assigned,
+			 * below we invalidate all candidates for the same opaque type ref but a different type
+			 */
+			PushMatrix();
+			int dwOpaqueRefId = oSignatureNode->toOpaque()->dwOpaqueRefId;
+			node_type_spec_t oSpec = (*oOpaqueAssignment)[dwOpaqueRefId];
+			std::multimap<int, unsigned int>::const_iterator itOpaque;
 
-				for (
-					itOpaque = aOpaqueIdToNode.find(dwOpaqueRefId);
-					itOpaque != aOpaqueIdToNode.end() && itOpaque->first == dwOpaqueRefId;
-					itOpaque++
-				) {
-					sparse_matrix_iterator_t itInner = oMatrix->FirstCandidate(itOpaque->second);
-					while (itInner.dwCodeNodeId != 0xffffffff) {
-						if (!oSpec.Matches(oCodeGraph->oGraph->FindNode(itInner.dwCodeNodeId))) {
-							oMatrix->Assign(
-								itOpaque->second,
-								itInner.dwCodeNodeId,
-								ASSIGNMENT_INVALID
-							);
-						}
-						itInner = oMatrix->NextCandidate(itInner);
+			for (
+				itOpaque = oPlan->aOpaqueIdToNode.find(dwOpaqueRefId);
+				itOpaque != oPlan->aOpaqueIdToNode.end() && itOpaque->first == dwOpaqueRefId;
+				itOpaque++
+			) {
+				sparse_matrix_iterator_t itInner = oMatrix->FirstCandidate(itOpaque->second);
+				while (itInner.dwCodeNodeId != 0xffffffff) {
+					if (!oSpec.Matches(oMatchGraph->FindNode(itInner.dwCodeNodeId))) {
+						Invalidate(itOpaque->second, itInner.dwCodeNodeId);
 					}
+					itInner = oMatrix->NextCandidate(itInner);
 				}
+			}
 
-				/* propagate invalidation to neighbors */
-				if (PruneFlagged()) {
-					oFlagMap->Assign(it.dwCodeNodeId);
-					DFGraphImpl::const_iterator itEP(itE);
-					itEP++;
-					if (Pass2Recurse(oFlagMap, itEP)) {
-						return true;
-					}
-					oFlagMap->Unassign(it.dwCodeNodeId);
-				}
-				PopMatrix();
-				oOpaqueAssignment->Unassign(oSignatureNode);
-				return false;
-			} else {
-				oMatrix->Assign(oSignatureNode->dwNodeId, it.dwCodeNodeId, ASSIGNMENT_VALID);
+			/* propagate invalidation to neighbors */
+			if (PruneFlagged()) {
 				oFlagMap->Assign(it.dwCodeNodeId);
-				DFGraphImpl::const_iterator itEP(itE);
-				itEP++;
-				if (Pass2Recurse(oFlagMap, itEP)) {
+				if (Pass2Recurse(oFlagMap)) {
 					return true;
 				}
 				oFlagMap->Unassign(it.dwCodeNodeId);
-				oMatrix->Assign(oSignatureNode->dwNodeId, it.dwCodeNodeId, ASSIGNMENT_UNDEFINED);
-				return false;
 			}
+			PopMatrix();
+			oOpaqueAssignment->Unassign(oSignatureNode);
+			return false;
 		} else {
-			while (it.dwCodeNodeId != 0xffffffff) { /* iterate candidates */
-				/* unassigned nodes only */
-				if (!oFlagMap->IsAssigned(it.dwCodeNodeId)) {
-					/*
-					 * attempt to claim opaque node type
-					 */
-					opaque_node_assign_t eAssignStatus = OPAQUE_NODE_ASSIGN_ALREADY_SET;
-					if (NODE_IS_OPAQUE(oSignatureNode) && 
-						(eAssignStatus = oOpaqueAssignment->Assign(
-							oSignatureNode,
-							oCodeGraph->oGraph->FindNode(it.dwCodeNodeId)
-						)) == OPAQUE_NODE_ASSIGN_NOK
-					) {
-						/*
-						 * Signature node type is opaque,
-						 * but currently assigned to a different node type
-						 */
-						goto _continue;
-					}
+			oMatrix->Assign(oSignatureNode->dwNodeId, it.dwCodeNodeId, ASSIGNMENT_VALID);
+			oFlagMap->Assign(it.dwCodeNodeId);
+			if (Pass2Recurse(oFlagMap)) {
+				return true;
+			}
+			oFlagMap->Unassign(it.dwCodeNodeId);
+			oMatrix->Assign(oSignatureNode->dwNodeId, it.dwCodeNodeId, ASSIGNMENT_UNDEFINED);
+			return false;
+		}
+	} else if (
+		oSplit == nullptr &&
+		oThreadPool->dwNumThreads > 1 &&
+		(dwChoicePoints++ % SIGNATURE_SPLIT_CHECK_INTERVAL) == 0 &&
+		SearchTreeBits() >= SIGNATURE_SPLIT_MIN_TREE_BITS
+	) {
+		return Pass2Split(oFlagMap, oSignatureNode);
+	} else {
+		while (it.dwCodeNodeId != 0xffffffff) { /* iterate candidates */
+			if (Pass2Try(oFlagMap, oSignatureNode, it.dwCodeNodeId)) {
+				return true;
+			}
+			it = oMatrix->NextCandidate(it);
 
-					/* unflag all possible assignments, except current candidate */
-					PushMatrix();
-					sparse_matrix_iterator_t itInner = oMatrix->FirstCandidate(oSignatureNode->dwNodeId);
-					while (itInner.dwCodeNodeId != 0xffffffff) {
-						oMatrix->Assign(
-							oSignatureNode->dwNodeId,
-							itInner.dwCodeNodeId,
-							it.dwCodeNodeId == itInner.dwCodeNodeId ? ASSIGNMENT_VALID : ASSIGNMENT_INVALID
-						);
-						itInner = oMatrix->NextCandidate(itInner);
-					}
+			if (Aborted()) {
+				return false;
+			}
+		}
+		return false;
+	}
+}
 
-					if (eAssignStatus == OPAQUE_NODE_ASSIGN_OK) {
-						/*
-						 * Opaque signature node type has just been assigned,
-						 * invalid candidates
-						 */
-						int dwOpaqueRefId = oSignatureNode->toOpaque()->dwOpaqueRefId;
-						node_type_spec_t oSpec = (*oOpaqueAssignment)[dwOpaqueRefId];
-						std::multimap<int, unsigned int>::iterator itOpaque;
-
-						for (
-							itOpaque = aOpaqueIdToNode.find(dwOpaqueRefId);
-							itOpaque != aOpaqueIdToNode.end() && itOpaque->first == dwOpaqueRefId;
-							itOpaque++
-						) {
-							sparse_matrix_iterator_t itInner = oMatrix->FirstCandidate(itOpaque->second);
-							while (itInner.dwCodeNodeId != 0xffffffff) {
-								if(!oSpec.Matches(oCodeGraph->oGraph->FindNode(itInner.dwCodeNodeId))) {
-									oMatrix->Assign(
-										itOpaque->second,
-										itInner.dwCodeNodeId,
-										ASSIGNMENT_INVALID
-									);
-								}
-								itInner = oMatrix->NextCandidate(itInner);
-							}
-						}
-					}
+/* oSignatureNode <-> dwCodeNodeId, one of several candidates */
+bool SignatureEvaluatorImpl::Pass2Try(FlagMap oFlagMap, DFGNode &oSignatureNode, unsigned int dwCodeNodeId) {
+	/* unassigned nodes only */
+	if (oFlagMap->IsAssigned(dwCodeNodeId)) {
+		return false;
+	}
+	/*
+	 * attempt to claim opaque node type
+	 */
+	opaque_node_assign_t eAssignStatus = OPAQUE_NODE_ASSIGN_ALREADY_SET;
+	if (NODE_IS_OPAQUE(oSignatureNode) &&
+		(eAssignStatus = oOpaqueAssignment->Assign(
+			oSignatureNode,
+			oMatchGraph->FindNode(dwCodeNodeId)
+		)) == OPAQUE_NODE_ASSIGN_NOK
+	) {
+		/*
+		 * Signature node type is opaque,
+		 * but currently assigned to a different node type
+		 */
+		return false;
+	}
 
-					if (PruneFlagged()) {
-						oFlagMap->Assign(it.dwCodeNodeId);
-						DFGraphImpl::const_iterator itEP(itE);
-						itEP++;
-						if (Pass2Recurse(oFlagMap, itEP)) {
-							return true;
-						}
-						oFlagMap->Unassign(it.dwCodeNodeId);
-					}
-					PopMatrix();
-					if (eAssignStatus == OPAQUE_NODE_ASSIGN_OK) {
-						oOpaqueAssignment->Unassign(oSignatureNode);
-					}
-				}
-_continue:
-				it = oMatrix->NextCandidate(it);
+	/* unflag all possible assignments, except current candidate */
+	PushMatrix();
+	sparse_matrix_iterator_t itInner = oMatrix->FirstCandidate(oSignatureNode->dwNodeId);
+	while (itInner.dwCodeNodeId != 0xffffffff) {
+		if (dwCodeNodeId == itInner.dwCodeNodeId) {
+			oMatrix->Assign(oSignatureNode->dwNodeId, itInner.dwCodeNodeId, ASSIGNMENT_VALID);
+		} else {
+			Invalidate(oSignatureNode->dwNodeId, itInner.dwCodeNodeId);
+		}
+		itInner = oMatrix->NextCandidate(itInner);
+	}
 
-				if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime) {
-					return false;
+	if (eAssignStatus == OPAQUE_NODE_ASSIGN_OK) {
+		/*
+		 * Opaque signature node type has just been assigned,
+		 * invalid candidates
+		 */
+		int dwOpaqueRefId = oSignatureNode->toOpaque()->dwOpaqueRefId;
+		node_type_spec_t oSpec = (*oOpaqueAssignment)[dwOpaqueRefId];
+		std::multimap<int, unsigned int>::const_iterator itOpaque;
+
+		for (
+			itOpaque = oPlan->aOpaqueIdToNode.find(dwOpaqueRefId);
+			itOpaque != oPlan->aOpaqueIdToNode.end() && itOpaque->first == dwOpaqueRefId;
+			itOpaque++
+		) {
+			sparse_matrix_iterator_t itInner = oMatrix->FirstCandidate(itOpaque->second);
+			while (itInner.dwCodeNodeId != 0xffffffff) {
+				if(!oSpec.Matches(oMatchGraph->FindNode(itInner.dwCodeNodeId))) {
+					Invalidate(itOpaque->second, itInner.dwCodeNodeId);
 				}
+				itInner = oMatrix->NextCandidate(itInner);
 			}
-			return false;
 		}
 	}
+
+	if (PruneFlagged()) {
+		oFlagMap->Assign(dwCodeNodeId);
+		if (Pass2Recurse(oFlagMap)) {
+			return true;
+		}
+		oFlagMap->Unassign(dwCodeNodeId);
+	}
+	PopMatrix();
+	if (eAssignStatus == OPAQUE_NODE_ASSIGN_OK) {
+		oOpaqueAssignment->Unassign(oSignatureNode);
+	}
+	return false;
 }
 
-bool SignatureEvaluatorImpl::Evaluate(AbstractEvaluationResult *lpOutput) {
-	DFGraphImpl::iterator itEx;
-	DFGraphImpl::iterator itCo;
-	SignatureDefinitionImpl::iterator itSig;
-	FlagMap oFlagMap;
-	bool bEvaluationResult = false;
+/*
+ * log2 estimate of the number of leaves below the current choice point,
+ * estimation stops once SIGNATURE_SPLIT_MIN_TREE_BITS is reached
+ */
+unsigned int SignatureEvaluatorImpl::SearchTreeBits() {
+	std::vector<plan_node_t>::const_iterator it;
+	unsigned int dwBits = 0;
 
-	dwStartTime = GetTickCount();
-	for (itSig = oSignatureDefinition->begin(); itSig != oSignatureDefinition->end(); itSig++) {
-		oSignatureGraph = (*itSig)->toGeneric(); // point oSignatureGraph to the current variant
-		oMatrix = SparseMatrix::create();
-		oMapping = AssignmentMap::create();
-		oOpaqueAssignment = OpaqueAssignment::create(oSignatureGraph->toSignatureGraph()->dwNumOpaqueRefs);
-		aStack.clear();
-		aOpaqueIdToNode.clear();
+	for (it = oPlan->aNodes.begin(); it != oPlan->aNodes.end() && dwBits < SIGNATURE_SPLIT_MIN_TREE_BITS; it++) {
+		if (!aSelected[it->oNode->dwNodeId]) {
+			unsigned int dwCount = oMatrix->CountCandidates(it->oNode->dwNodeId, 1u << (SIGNATURE_SPLIT_MIN_TREE_BITS - dwBits));
+			while (dwCount >>= 1) {
+				dwBits++;
+			}
+		}
+	}
+	return dwBits;
+}
 
-		DWORD dwVariantStartTime = GetTickCount();
-		for (itEx = oSignatureGraph->oGraph->begin(); itEx != oSignatureGraph->oGraph->end(); itEx++) {
-			bool bExists = false;
+/*
+ * the candidates of oSignatureNode are searched by this evaluator and by idle workers,
+ * each on a copy of the current state
+ */
+bool SignatureEvaluatorImpl::Pass2Split(FlagMap oFlagMap, DFGNode &oSignatureNode) {
+	SearchSplit oShared = SearchSplit::create(this, oSignatureNode, oFlagMap);
+	ThreadTask oTask = oShared->toThreadTask();
+	unsigned int dwCodeNodeId;
+	size_t i;
 
-			if (NODE_IS_OPAQUE(itEx->second)) {
-				int dwOpaqueRef = DFGOpaque::typecast(itEx->second)->dwOpaqueRefId;
-				if (dwOpaqueRef != -1) {
-					aOpaqueIdToNode.insert(std::pair<int, unsigned int>(dwOpaqueRef, itEx->second->dwNodeId));
-				}
-			}
-			if (itEx->second->aOutputNodes.begin() != itEx->second->aOutputNodes.end()) {
-				// this node has output nodes -> will be covered by recursive traversal of child
-				continue;
+	wc_debug("[*] splitting %s over the pool : %u candidates for node %u\n",
+		oSignatureDefinition->szIdentifier.c_str(),
+		(unsigned int)oShared->aCandidates.size(),
+		oSignatureNode->dwNodeId
+	);
+	oSplit = oShared;
+	for (i = 1; i < oShared->aCandidates.size() && i < (size_t)oThreadPool->dwNumThreads; i++) {
+		oThreadPool->Schedule(oTask, NULL);
+	}
+	while (!Aborted() && oShared->Claim(&dwCodeNodeId)) {
+		oShared->Release(Pass2Try(oFlagMap, oSignatureNode, dwCodeNodeId) ? oMapping : nullptr);
+	}
+	oShared->Wait();
+	oSplit = nullptr;
+
+	if (oShared->oMapping != nullptr) {
+		oMapping = oShared->oMapping;
+		return true;
+	}
+	return false;
+}
+
+/* evaluator of the same variant against the same code graph, without any matching state */
+SignatureEvaluator SignatureEvaluatorImpl::Clone() {
+	SignatureEvaluator oClone = SignatureEvaluator::create(oSignatureDefinition);
+
+	oClone->oThreadPool = oThreadPool;
+	oClone->oCodeGraph = oCodeGraph;
+	oClone->oToken = oToken;
+	oClone->dwMaxEvaluationTime = dwMaxEvaluationTime;
+	oClone->dwStartTime = dwStartTime;
+	oClone->oSignatureGraph = oSignatureGraph;
+	oClone->oPlan = oPlan;
+	oClone->oMatchGraph = oMatchGraph;
+	oClone->oVerdicts = oVerdicts;
+	oClone->dwVerdictSnapshot = dwVerdictSnapshot;
+	return oClone;
+}
+
+/* private copy of this evaluator at the choice point of oShared */
+SignatureEvaluator SignatureEvaluatorImpl::Branch(SearchSplit oShared) {
+	SignatureEvaluator oBranch = Clone();
+
+	oBranch->oMatrix = oShared->oMatrix->copy();
+	oBranch->oOpaqueAssignment = oShared->oOpaqueAssignment->copy();
+	oBranch->oMapping = AssignmentMap::create();
+	oBranch->aSelected = oShared->aSelected;
+	oBranch->oSplit = oShared;
+	return oBranch;
+}
+
+bool SignatureEvaluatorImpl::Aborted() {
+	return (GetTickCount() - dwStartTime) > dwMaxEvaluationTime || Cancelled() || (oSplit != nullptr && oSplit->bFound);
+}
+
+SearchSplitImpl::SearchSplitImpl(SignatureEvaluatorImpl *lpParent, DFGNode &oSignatureNode, FlagMap &oFlagMap)
+	: oParent(SignatureEvaluator::typecast(lpParent)), oSignatureNode(oSignatureNode), bFound(false), dwNext(0), dwActive(0) {
+	sparse_matrix_iterator_t it = lpParent->oMatrix->FirstCandidate(oSignatureNode->dwNodeId);
+
+	oMatrix = lpParent->oMatrix->copy();
+	oOpaqueAssignment = lpParent->oOpaqueAssignment->copy();
+	this->oFlagMap = FlagMap::create();
+	this->oFlagMap->assign(oFlagMap->begin(), oFlagMap->end());
+	aSelected = lpParent->aSelected;
+	while (it.dwCodeNodeId != 0xffffffff) {
+		aCandidates.push_back(it.dwCodeNodeId);
+		it = oMatrix->NextCandidate(it);
+	}
+}
+
+bool SearchSplitImpl::Claim(unsigned int *lpCodeNodeId) {
+	std::unique_lock<std::mutex> mLock(stMutex);
+	if (bFound || dwNext >= aCandidates.size()) {
+		return false;
+	}
+	*lpCodeNodeId = aCandidates[dwNext++];
+	dwActive++;
+	return true;
+}
+
+/* end of a claimed branch, oResult is the mapping if the branch matched */
+void SearchSplitImpl::Release(AssignmentMap oResult) {
+	std::unique_lock<std::mutex> mLock(stMutex);
+	if (oResult != nullptr && !bFound) {
+		oMapping = oResult;
+		bFound = true;
+	}
+	if (--dwActive == 0) {
+		stIdle.notify_all();
+	}
+}
+
+/* no new branch is handed out once this returns, wait for the ones still being searched */
+void SearchSplitImpl::Wait() {
+	std::unique_lock<std::mutex> mLock(stMutex);
+	dwNext = aCandidates.size();
+	while (dwActive != 0) {
+		stIdle.wait(mLock);
+	}
+}
+
+/* helper worker : search branches until none are left */
+unsigned long SearchSplitImpl::Execute(void *lpPrivate) {
+	SignatureEvaluator oBranch;
+	FlagMap oBranchFlagMap;
+	unsigned int dwCodeNodeId;
+
+	while (Claim(&dwCodeNodeId)) {
+		if (oBranch == nullptr) {
+			oBranch = oParent->Branch(SearchSplit::typecast(this));
+			oBranchFlagMap = FlagMap::create();
+			oBranchFlagMap->assign(oFlagMap->begin(), oFlagMap->end());
+		}
+		if (oBranch->Aborted()) {
+			Release(nullptr);
+			break;
+		}
+		Release(oBranch->Pass2Try(oBranchFlagMap, oSignatureNode, dwCodeNodeId) ? oBranch->oMapping : nullptr);
+	}
+	/* the copies refer back to this split */
+	if (oBranch != nullptr) {
+		oBranch->oSplit = nullptr;
+	}
+	return 0;
+}
+
+/* code nodes a signature node may map to, judging by its type (and value) only */
+const std::vector<DFGNode> &SignatureEvaluatorImpl::TypeCandidates(const DFGNode &oSignatureNode) {
+	DFGNode oNode = oSignatureNode;
+	return NODE_IS_CONSTANT(oNode) ?
+		oMatchGraph->ConstantsWithValue(oNode->toConstant()->dwValue) :
+		oMatchGraph->NodesOfType(oNode->eNodeType);
+}
+
+/*
+ * code nodes pass 1 starts from for the root oPlan->aRoots[dwRoot] : the code nodes of the root's type,
+ * or, when an anchor below the root is a lot rarer (a round constant, say),
+ * the nodes of the root's type within reach above the anchor's candidates.
+ * aBuffer holds the seeds unless they come straight from the type index
+ */
+const std::vector<DFGNode> &SignatureEvaluatorImpl::Seeds(unsigned int dwRoot, std::vector<DFGNode> &aBuffer) {
+	DFGraph oGraph = oMatchGraph;
+	DFGNode oRoot = oPlan->Node(oPlan->aRoots[dwRoot]).oNode;
+	unsigned int dwComponentSize = oPlan->Node(oPlan->aRoots[dwRoot]).dwComponentSize;
+	std::vector<plan_anchor_t>::const_iterator itAnchor;
+	std::vector<std::pair<DFGNode, unsigned int>> aQueue;
+	std::vector<DFGNode>::const_iterator itCandidate;
+	std::unordered_map<unsigned int, DFGNode>::const_iterator itOut;
+	std::vector<char> aVisited;
+	const plan_anchor_t *lpBest = NULL;
+	const std::vector<DFGNode> *lpAnchorCandidates;
+	DFGraphImpl::const_iterator itCo;
+	size_t dwBaseline, dwBestCost, i;
+
+	aBuffer.clear();
+	if (!oGraph->HasTypeIndex()) {
+		goto _all_nodes;
+	}
+	dwBaseline = NODE_IS_OPAQUE(oRoot) ? oGraph->size() : TypeCandidates(oRoot).size();
+
+	/* every level walked up may fan out, rarity has to make up for the depth */
+	dwBestCost = dwBaseline;
+	for (itAnchor = oPlan->aAnchors[dwRoot].begin(); itAnchor != oPlan->aAnchors[dwRoot].end(); itAnchor++) {
+		size_t dwCost = TypeCandidates(oPlan->Node(itAnchor->dwNodeId).oNode).size() * (itAnchor->dwDepth + 1) * SIGNATURE_ANCHOR_FANOUT;
+		if (itAnchor->dwDepth != 0 && dwCost < dwBestCost) {
+			lpBest = &*itAnchor;
+			dwBestCost = dwCost;
+		}
+	}
+	if (lpBest == NULL) {
+		goto _baseline;
+	}
+
+	/* breadth first along the outputs, up to lpBest->dwDepth levels */
+	aVisited.assign(oGraph->dwNodeCounter, 0);
+	lpAnchorCandidates = &TypeCandidates(oPlan->Node(lpBest->dwNodeId).oNode);
+	for (itCandidate = lpAnchorCandidates->begin(); itCandidate != lpAnchorCandidates->end(); itCandidate++) {
+		aVisited[(*itCandidate)->dwNodeId] = 1;
+		aQueue.push_back(std::make_pair(*itCandidate, 0));
+	}
+	for (i = 0; i < aQueue.size(); i++) {
+		DFGNode oNode = aQueue[i].first;
+		if ((NODE_IS_OPAQUE(oRoot) || IsCandidate(oRoot, oNode)) && oGraph->ComponentSize(oNode->dwNodeId) >= dwComponentSize) {
+			aBuffer.push_back(oNode);
+		}
+		if (aQueue.size() > dwBaseline) {
+			/* not that selective after all */
+			aBuffer.clear();
+			goto _baseline;
+		}
+		if (aQueue[i].second == lpBest->dwDepth) {
+			continue;
+		}
+		for (itOut = oNode->aOutputNodes.begin(); itOut != oNode->aOutputNodes.end(); itOut++) {
+			if (!aVisited[itOut->first]) {
+				aVisited[itOut->first] = 1;
+				aQueue.push_back(std::make_pair(itOut->second, aQueue[i].second + 1));
 			}
+		}
+	}
+	/* keep the creation order of the type index */
+	std::sort(aBuffer.begin(), aBuffer.end(), [](const DFGNode &a, const DFGNode &b) { return a->dwNodeId < b->dwNodeId; });
+	return aBuffer;
 
-			/*
-			 * pass 1: enumerate all possible assignments
-			 */
-			for (itCo = oCodeGraph->oGraph->begin(); itCo != oCodeGraph->oGraph->end(); itCo++) {
-				if (Pass1Recurse(itEx->second, itCo->second) == ASSIGNMENT_UNDEFINED) {
-					bExists = true;
-				}
+_baseline:
+	/* code components too small for the root's own are skipped altogether */
+	if (!NODE_IS_OPAQUE(oRoot)) {
+		if (oGraph->SmallestComponent() >= dwComponentSize) {
+			return TypeCandidates(oRoot);
+		}
+		lpAnchorCandidates = &TypeCandidates(oRoot);
+		for (itCandidate = lpAnchorCandidates->begin(); itCandidate != lpAnchorCandidates->end(); itCandidate++) {
+			if (oGraph->ComponentSize((*itCandidate)->dwNodeId) >= dwComponentSize) {
+				aBuffer.push_back(*itCandidate);
 			}
+		}
+		return aBuffer;
+	}
+	for (itCo = oGraph->begin(); itCo != oGraph->end(); itCo++) {
+		if (oGraph->ComponentSize(itCo->second->dwNodeId) >= dwComponentSize) {
+			aBuffer.push_back(itCo->second);
+		}
+	}
+	return aBuffer;
+
+_all_nodes:
+	for (itCo = oGraph->begin(); itCo != oGraph->end(); itCo++) {
+		aBuffer.push_back(itCo->second);
+	}
+	return aBuffer;
+}
+
+/*
+ * fills oMatrix with the pass 1 results of every root and seed,
+ * the sequential pass 1 then only reads them back
+ */
+void SignatureEvaluatorImpl::Pass1Parallel() {
+	CandidateScan oScan = CandidateScan::create(this);
+	ThreadTask oTask = oScan->toThreadTask();
+	unsigned int dwSlice;
+	size_t i;
 
-			if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime) {
-				goto _time_exceeded;
+	for (i = 1; i < oScan->aSlices.size() && i < (size_t)oThreadPool->dwNumThreads; i++) {
+		oThreadPool->Schedule(oTask, NULL);
+	}
+	while (oScan->Claim(&dwSlice, false)) {
+		oScan->Scan(this, dwSlice);
+	}
+	oScan->Wait();
+	oMatrix->Merge(*oScan->oMerged);
+	aPendingVerdicts.insert(aPendingVerdicts.end(), oScan->aVerdicts.begin(), oScan->aVerdicts.end());
+}
+
+CandidateScanImpl::CandidateScanImpl(SignatureEvaluatorImpl *lpParent)
+	: oParent(SignatureEvaluator::typecast(lpParent)), dwNext(0), dwActive(0) {
+	std::vector<unsigned int>::const_iterator itEx;
+	candidate_slice_t stSlice;
+
+	oInitial = lpParent->oMatrix->copy();
+	oMerged = SparseMatrix::create(lpParent->oPlan->dwNodeCounter);
+	for (itEx = lpParent->oPlan->aRoots.begin(); itEx != lpParent->oPlan->aRoots.end(); itEx++) {
+		DFGNode oRoot = lpParent->oPlan->Node(*itEx).oNode;
+
+		aRoots.push_back(oRoot);
+		aSeeds.push_back(std::vector<DFGNode>());
+		/* same seeds as the sequential pass 1 */
+		std::vector<DFGNode> aBuffer;
+		aSeeds.back() = lpParent->Seeds((unsigned int)(itEx - lpParent->oPlan->aRoots.begin()), aBuffer);
+
+		stSlice.dwRoot = (unsigned int)(aRoots.size() - 1);
+		for (stSlice.dwBegin = 0; stSlice.dwBegin < aSeeds.back().size(); stSlice.dwBegin += SIGNATURE_PASS1_SLICE) {
+			stSlice.dwEnd = stSlice.dwBegin + SIGNATURE_PASS1_SLICE;
+			if (stSlice.dwEnd > aSeeds.back().size()) {
+				stSlice.dwEnd = aSeeds.back().size();
 			}
+			aSlices.push_back(stSlice);
+		}
+	}
+}
+
+/* bRegister : first claim of a helper, which then owes a Merge */
+bool CandidateScanImpl::Claim(unsigned int *lpSlice, bool bRegister) {
+	std::unique_lock<std::mutex> mLock(stMutex);
+	if (dwNext >= aSlices.size()) {
+		return false;
+	}
+	*lpSlice = (unsigned int)dwNext++;
+	if (bRegister) {
+		dwActive++;
+	}
+	return true;
+}
+
+void CandidateScanImpl::Scan(SignatureEvaluatorImpl *lpScanner, unsigned int dwSlice) {
+	const candidate_slice_t &stSlice = aSlices[dwSlice];
+	size_t i;
+
+	for (i = stSlice.dwBegin; i < stSlice.dwEnd; i++) {
+		lpScanner->Pass1Recurse(aRoots[stSlice.dwRoot], aSeeds[stSlice.dwRoot][i]);
+	}
+}
+
+void CandidateScanImpl::Merge(SparseMatrix oPartial, const std::vector<unsigned long long> &aPartialVerdicts) {
+	std::unique_lock<std::mutex> mLock(stMutex);
+	oMerged->Merge(*oPartial);
+	aVerdicts.insert(aVerdicts.end(), aPartialVerdicts.begin(), aPartialVerdicts.end());
+	if (--dwActive == 0) {
+		stIdle.notify_all();
+	}
+}
 
-			if (!bExists) {
-				goto _next;
+/* all slices are handed out once this is called, wait for the helpers to merge */
+void CandidateScanImpl::Wait() {
+	std::unique_lock<std::mutex> mLock(stMutex);
+	while (dwActive != 0) {
+		stIdle.wait(mLock);
+	}
+}
+
+/* helper worker : scan slices on a private matrix until none are left */
+unsigned long CandidateScanImpl::Execute(void *lpPrivate) {
+	SignatureEvaluator oScanner;
+	unsigned int dwSlice;
+
+	while (Claim(&dwSlice, oScanner == nullptr)) {
+		if (oScanner == nullptr) {
+			oScanner = oParent->Clone();
+			oScanner->oMatrix = oInitial->copy();
+		}
+		Scan(oScanner.lpNode, dwSlice);
+	}
+	if (oScanner != nullptr) {
+		Merge(oScanner->oMatrix, oScanner->aPendingVerdicts);
+	}
+	return 0;
+}
+
+/*
+ * matches the current variant (oSignatureGraph, oPlan) against the code graph,
+ * oMapping holds the assignment on success
+ */
+bool SignatureEvaluatorImpl::MatchVariant() {
+	std::vector<unsigned int>::const_iterator itEx;
+	std::vector<DFGNode>::const_iterator itSeed;
+	FlagMap oFlagMap;
+
+	oMatrix = SparseMatrix::create(oSignatureGraph->oGraph->dwNodeCounter);
+	oMapping = AssignmentMap::create();
+	oOpaqueAssignment = OpaqueAssignment::create(oSignatureGraph->toSignatureGraph()->dwNumOpaqueRefs);
+	/* start from what earlier variants learned about equal sub-patterns */
+	ShareRows(true);
+
+	if (oThreadPool->dwNumThreads > 1 && oMatchGraph->size() >= SIGNATURE_PARALLEL_PASS1_MIN_NODES) {
+		Pass1Parallel();
+	}
+	for (itEx = oPlan->aRoots.begin(); itEx != oPlan->aRoots.end(); itEx++) {
+		bool bExists = false;
+		/* nodes with outputs are covered by the recursive traversal of the roots */
+		DFGNode oRoot = oPlan->Node(*itEx).oNode;
+
+		/*
+		 * pass 1: enumerate all possible assignments,
+		 * starting from code nodes of a compatible type only
+		 */
+		std::vector<DFGNode> aBuffer;
+		const std::vector<DFGNode> &aSeeds = Seeds((unsigned int)(itEx - oPlan->aRoots.begin()), aBuffer);
+		for (itSeed = aSeeds.begin(); itSeed != aSeeds.end(); itSeed++) {
+			if (Pass1Recurse(oRoot, *itSeed) == ASSIGNMENT_UNDEFINED) {
+				bExists = true;
 			}
 		}
 
-		oMatrix->CleanInvalid();
-		if (!PruneFlagged()) {
-			goto _next;
+		if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime || Cancelled()) {
+			/* the caller reports it */
+			return false;
+		}
+
+		if (!bExists) {
+			ShareRows(false);
+			return false;
+		}
+	}
+
+	ShareRows(false);
+	oMatrix->CleanInvalid();
+	if (!PruneAll()) {
+		return false;
+	}
+	oFlagMap = FlagMap::create(oMatchGraph->dwNodeCounter);
+	aSelected.assign(oSignatureGraph->oGraph->dwNodeCounter, 0);
+	return Pass2Recurse(oFlagMap);
+}
+
+bool SignatureEvaluatorImpl::Evaluate(AbstractEvaluationResult *lpOutput) {
+	SignatureDefinitionImpl::iterator itSig;
+	MatchPlan oVariantPlan;
+	bool bEvaluationResult = false;
+
+	dwStartTime = GetTickCount();
+	oMatchGraph = oCodeGraph->toCodeGraph()->MatchGraph();
+	aClassRows.clear();
+	aNewVerdicts.clear();
+	if (oCodeGraph->toCodeGraph()->Context() != nullptr) {
+		oVerdicts = oCodeGraph->toCodeGraph()->Context()->Verdicts(Identifier(), dwVerdictSnapshot);
+	}
+	for (itSig = oSignatureDefinition->begin(); itSig != oSignatureDefinition->end(); itSig++) {
+		oVariantPlan = (*itSig)->oMatchPlan;
+		if (oVariantPlan == nullptr) {
+			/* signature wasn't loaded through ConstructSignatures */
+			oVariantPlan = MatchPlan::create(*itSig);
+		}
+
+		DWORD dwVariantStartTime = GetTickCount();
+		if (oVariantPlan->oCore != nullptr) {
+			/* every match of the variant contains a match of its core (see MatchPlanImpl::Minimize), try that first */
+			oSignatureGraph = oVariantPlan->oCoreGraph->toGeneric();
+			oPlan = oVariantPlan->oCore;
+			bEvaluationResult = MatchVariant();
+		}
+		oSignatureGraph = (*itSig)->toGeneric(); // point oSignatureGraph to the current variant
+		oPlan = oVariantPlan;
+		if (oVariantPlan->oCore == nullptr || bEvaluationResult) {
+			bEvaluationResult = MatchVariant();
 		}
-		oFlagMap = FlagMap::create();
-		bEvaluationResult = Pass2Recurse(oFlagMap, oSignatureGraph->oGraph->begin());
 
-_next:
 		DWORD dwVariantEndTime = GetTickCount();
 		wc_debug("[*] time taken to evalutate %s (%.1500s) against %s (variant %s) found=%d: %fs\n",
 			oCodeGraph->toCodeGraph()->szFunctionName.c_str(),
@@ -542,6 +1040,14 @@ _next:
 		if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime) {
 			goto _time_exceeded;
 		}
+		if (Cancelled()) {
+			wc_debug("[*] evaluation cancelled for function %s (%s), signature : %s\n",
+				this->oCodeGraph->toCodeGraph()->szFunctionName.c_str(),
+				this->oCodeGraph->toCodeGraph()->oStatePredicate->expression(2).c_str(),
+				oSignatureDefinition->szIdentifier.c_str()
+			);
+			break;
+		}
 	}
 
 	if ((GetTickCount() - dwStartTime) > dwMaxEvaluationTime) {
@@ -562,10 +1068,21 @@ _time_exceeded:
 		((double)(dwEndTime - dwStartTime) / 1000)
 	);
 
+	if (bEvaluationResult && oMatchGraph != oCodeGraph->oGraph) {
+		/* hand out the code graph's own nodes, not those of the reduced copy */
+		AssignmentMap oTranslated = AssignmentMap::create();
+		AssignmentMapImpl::iterator itMap;
+		for (itMap = oMapping->begin(); itMap != oMapping->end(); itMap++) {
+			DFGNode oCodeNode = oCodeGraph->oGraph->FindNode(itMap->first->dwNodeId);
+			oTranslated->Assign(itMap->second, oCodeNode);
+		}
+		oMapping = oTranslated;
+	}
+
 	*lpOutput = SignatureEvaluationResult::create(
 		SignatureEvaluator::typecast(this),
 		oCodeGraph,
-		bEvaluationResult ? EVALUATION_RESULT_MATCH_FOUND : EVALUATION_RESULT_NO_MATCH_FOUND,
+		bEvaluationResult ? EVALUATION_RESULT_MATCH_FOUND : (Cancelled() ? EVALUATION_RESULT_CANCELLED : EVALUATION_RESULT_NO_MATCH_FOUND),
 		bEvaluationResult ? oSignatureGraph : nullptr,
 		bEvaluationResult ? oMapping : nullptr
 	)->toAbstract();
@@ -574,24 +1091,66 @@ _time_exceeded:
 	oSignatureGraph = nullptr;
 	oMapping = nullptr;
 	oMatrix = nullptr;
-	aStack.clear();
-	aOpaqueIdToNode.clear();
+	oPlan = nullptr;
+	oMatchGraph = nullptr;
+	aClassRows.clear();
+	if (aNewVerdicts.begin() != aNewVerdicts.end() && oCodeGraph->toCodeGraph()->Context() != nullptr) {
+		oCodeGraph->toCodeGraph()->Context()->PublishVerdicts(Identifier(), aNewVerdicts);
+	}
+	oVerdicts = nullptr;
+	aNewVerdicts.clear();
 
 	return bEvaluationResult;
 }
 
+/*
+ * pass 1 results only depend on a signature node's class (see MatchPlanImpl::Classify),
+ * rows are handed from one variant to the next through aClassRows :
+ * bLoad seeds the fresh matrix, !bLoad stores what pass 1 explored
+ * (and keeps its failures for the sibling paths, see PublishVerdicts)
+ */
+void SignatureEvaluatorImpl::ShareRows(bool bLoad) {
+	std::vector<plan_node_t>::const_iterator it;
+	std::unordered_map<unsigned int, sparse_matrix_row_t>::iterator itRow;
+
+	if (bLoad) {
+		aPendingVerdicts.clear();
+	} else {
+		aNewVerdicts.insert(aNewVerdicts.end(), aPendingVerdicts.begin(), aPendingVerdicts.end());
+		aPendingVerdicts.clear();
+	}
+
+	for (it = oPlan->aNodes.begin(); it != oPlan->aNodes.end(); it++) {
+		if (bLoad) {
+			itRow = aClassRows.find(it->dwClassId);
+			if (itRow != aClassRows.end()) {
+				oMatrix->LoadRow(it->oNode->dwNodeId, itRow->second);
+			}
+		} else {
+			oMatrix->SaveRow(it->oNode->dwNodeId, aClassRows[it->dwClassId]);
+		}
+	}
+}
+
 bool SignatureEvaluatorImpl::IsCandidate(const DFGNode &oSignatureNode, const DFGNode &oCodeNode) {
 	// flag the current node so we know it's being processed
 	if (NODE_IS_CONSTANT(oSignatureNode)) {
-		return oSignatureNode->eNodeType == oCodeNode->eNodeType &&
-			((DFGNode)oSignatureNode)->toConstant()->dwValue == ((DFGNode)oCodeNode)->toConstant()->dwValue;
+		if (!(oSignatureNode->eNodeType == oCodeNode->eNodeType &&
+			((DFGNode)oSignatureNode)->toConstant()->dwValue == ((DFGNode)oCodeNode)->toConstant()->dwValue)
+		) {
+			return false;
+		}
 	} else if (NODE_IS_OPAQUE(oSignatureNode)) {
 		return true;
-	} else {
-		return oSignatureNode->eNodeType == oCodeNode->eNodeType;
+	} else if (oSignatureNode->eNodeType != oCodeNode->eNodeType) {
+		return false;
 	}
 
-	return true;
+	/* the code node must have room for the signature node's neighbourhood */
+	return !oMatchGraph->HasTypeIndex() || FingerprintDominates(
+		oMatchGraph->Fingerprint(oCodeNode->dwNodeId),
+		oPlan->Node(oSignatureNode->dwNodeId).stFingerprint
+	);
 }
 
 inline node_type_spec_t::node_type_spec_t(const DFGNode & oNode) {
@@ -3,6 +3,12 @@
 #include <map>
 #include <vector>
 #include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include <idp.hpp>
 
 #include "types.hpp"
@@ -11,6 +17,18 @@
 #include "Broker.hpp" // for New(Xor|And|Add)
 #include "SignatureParser.hpp"
 #include "AnalysisResult.hpp"
+#include "ThreadPool.hpp"
+#include "FunctionContext.hpp"
+
+/* split a pass 2 choice point over the pool once the search tree is estimated at 2^x leaves or more */
+#define SIGNATURE_SPLIT_MIN_TREE_BITS 24
+/* the search tree is only estimated at one in that many pass 2 choice points with several candidates */
+#define SIGNATURE_SPLIT_CHECK_INTERVAL 64
+/* pass 1 is spread over the pool for code graphs of at least that many nodes, in slices of that many seeds */
+#define SIGNATURE_PARALLEL_PASS1_MIN_NODES 16384
+#define SIGNATURE_PASS1_SLICE 1024
+/* assumed number of outputs per code node, when weighing an anchor against its depth below the root */
+#define SIGNATURE_ANCHOR_FANOUT 4
 
 typedef enum {
 	ASSIGNMENT_UNEXPLORED = 0,
@@ -56,114 +74,288 @@ typedef struct sparse_matrix_iterator_t {
 	}
 } sparse_matrix_iterator_t;
 
-class SparseMatrixImpl : virtual public ReferenceCounted, public std::map<unsigned long long, unsigned long long> {
+/* index of the lowest set bit, qwWord must not be 0 */
+static inline unsigned int LowestSetBit(unsigned long long qwWord) {
+#ifdef _MSC_VER
+	unsigned long dwIndex;
+	_BitScanForward64(&dwIndex, qwWord);
+	return dwIndex;
+#else
+	return __builtin_ctzll(qwWord);
+#endif
+}
+
+static inline unsigned int PopCount(unsigned long long qwWord) {
+#ifdef _MSC_VER
+	return (unsigned int)__popcnt64(qwWord);
+#else
+	return __builtin_popcountll(qwWord);
+#endif
+}
+
+/*
+ * cells of a single signature node, as two bit planes over a window of code node ids :
+ *   aCandidate : ASSIGNMENT_UNDEFINED or ASSIGNMENT_VALID (bit 1 of assignment_t)
+ *   aDecided   : ASSIGNMENT_INVALID or ASSIGNMENT_VALID (bit 0 of assignment_t)
+ * word i of both planes covers code node ids [(dwBase + i) * 64, (dwBase + i + 1) * 64)
+ */
+typedef struct sparse_matrix_row_t {
+	inline sparse_matrix_row_t() : dwBase(0) { }
+	unsigned int dwBase;
+	std::vector<unsigned long long> aCandidate;
+	std::vector<unsigned long long> aDecided;
+} sparse_matrix_row_t;
+
+/* cell overwritten after the last choice point, see SparseMatrixImpl::Mark */
+typedef struct sparse_matrix_trail_t {
+	unsigned int dwSignatureNodeId;
+	unsigned int dwCodeNodeId;
+	assignment_t ePrevious;
+} sparse_matrix_trail_t;
+
+class SparseMatrixImpl : virtual public ReferenceCounted {
 public:
+	inline SparseMatrixImpl(unsigned int dwNumRows = 0) : aRows(dwNumRows) { }
+	inline SparseMatrixImpl(const SparseMatrixImpl &other) = default;
+	inline SparseMatrix copy() const { return SparseMatrix::create(*this); }
+
 	inline assignment_t GetAssignment(unsigned int dwSignatureNodeId, unsigned int dwCodeNodeId) const {
-		unsigned long long qwIndex = (((unsigned long long)dwSignatureNodeId) << 27) | (dwCodeNodeId >> 5);
-		unsigned int dwShift = ((dwCodeNodeId & 0x1f) << 1);
-		const_iterator it = find(qwIndex);
-		if (it == end()) {
+		if (dwSignatureNodeId >= aRows.size()) {
+			return ASSIGNMENT_UNEXPLORED;
+		}
+		const sparse_matrix_row_t &stRow = aRows[dwSignatureNodeId];
+		unsigned int dwWord = (dwCodeNodeId >> 6) - stRow.dwBase;
+		if ((dwCodeNodeId >> 6) < stRow.dwBase || dwWord >= stRow.aCandidate.size()) {
 			return ASSIGNMENT_UNEXPLORED;
 		}
-		return (assignment_t)((it->second >> dwShift) & 0x3);
+		unsigned int dwShift = dwCodeNodeId & 0x3f;
+		return (assignment_t)(
+			(((stRow.aCandidate[dwWord] >> dwShift) & 1) << 1) |
+			((stRow.aDecided[dwWord] >> dwShift) & 1)
+		);
 	}
-	inline SparseMatrixImpl() { }
-	inline SparseMatrixImpl(const SparseMatrixImpl &other) = default;
-	inline SparseMatrix copy() const { return SparseMatrix::create(*this); }
-	inline void Assign(unsigned int dwSignatureNodeId, unsigned int dwCodeNodeId, assignment_t eType, bool bKeepInvalid = false) {
-		unsigned long long qwIndex = (((unsigned long long)dwSignatureNodeId) << 27) | (dwCodeNodeId >> 5);
-		unsigned int dwShift = ((dwCodeNodeId & 0x1f) << 1);
-		iterator it = find(qwIndex);
-		if (it != end()) {
-			it->second &= ~(3ULL << dwShift);
-			it->second |= (unsigned long long)eType << dwShift;
-
-			if (!bKeepInvalid && !(it->second & ~0x5555555555555555ULL)) {
-				erase(it);
+	inline void Assign(unsigned int dwSignatureNodeId, unsigned int dwCodeNodeId, assignment_t eType) {
+		if (aMarks.begin() != aMarks.end()) {
+			sparse_matrix_trail_t stEntry;
+			stEntry.ePrevious = GetAssignment(dwSignatureNodeId, dwCodeNodeId);
+			if (stEntry.ePrevious == eType) {
+				return;
 			}
-		} else if ((bKeepInvalid && eType >= ASSIGNMENT_INVALID) || eType >= ASSIGNMENT_UNDEFINED) {
-			insert(std::pair<unsigned long long, unsigned long long>(qwIndex, (unsigned long long)eType << dwShift));
+			stEntry.dwSignatureNodeId = dwSignatureNodeId;
+			stEntry.dwCodeNodeId = dwCodeNodeId;
+			aTrail.push_back(stEntry);
+		}
+		Set(dwSignatureNodeId, dwCodeNodeId, eType);
+	}
+	/*
+	 * choice points : Undo() restores every cell assigned since the matching Mark(),
+	 * Commit() drops the choice point but keeps the changes
+	 */
+	inline void Mark() {
+		aMarks.push_back(aTrail.size());
+	}
+	inline void Undo() {
+		if (aMarks.begin() == aMarks.end()) {
+			return;
+		}
+		while (aTrail.size() > aMarks.back()) {
+			const sparse_matrix_trail_t &stEntry = aTrail.back();
+			Set(stEntry.dwSignatureNodeId, stEntry.dwCodeNodeId, stEntry.ePrevious);
+			aTrail.pop_back();
+		}
+		aMarks.pop_back();
+	}
+	inline void Commit() {
+		if (aMarks.begin() == aMarks.end()) {
+			return;
+		}
+		aMarks.pop_back();
+		if (aMarks.begin() == aMarks.end()) {
+			/* outermost choice point, nothing left to restore to */
+			aTrail.clear();
 		}
 	}
+	/*
+	 * forget invalid cells (they read as unexplored from here on)
+	 * and shrink every row to the window holding its candidates, keeping copies cheap
+	 */
 	inline void CleanInvalid() {
-		iterator it;
-		for (it = begin(); it != end(); ) {
-			if (!(it->second & ~0x5555555555555555ULL)) {
-				it = erase(it);
-			} else {
-				it++;
+		std::vector<sparse_matrix_row_t>::iterator it;
+		for (it = aRows.begin(); it != aRows.end(); it++) {
+			size_t dwFirst = 0, dwEnd = it->aCandidate.size(), i;
+			while (dwFirst < dwEnd && it->aCandidate[dwFirst] == 0) {
+				dwFirst++;
+			}
+			while (dwEnd > dwFirst && it->aCandidate[dwEnd - 1] == 0) {
+				dwEnd--;
 			}
+			for (i = dwFirst; i < dwEnd; i++) {
+				it->aDecided[i] &= it->aCandidate[i];
+			}
+			if (dwFirst == dwEnd) {
+				it->dwBase = 0;
+				it->aCandidate.clear();
+				it->aDecided.clear();
+				it->aCandidate.shrink_to_fit();
+				it->aDecided.shrink_to_fit();
+				continue;
+			}
+			it->dwBase += (unsigned int)dwFirst;
+			it->aCandidate = std::vector<unsigned long long>(it->aCandidate.begin() + dwFirst, it->aCandidate.begin() + dwEnd);
+			it->aDecided = std::vector<unsigned long long>(it->aDecided.begin() + dwFirst, it->aDecided.begin() + dwEnd);
 		}
 	}
-	sparse_matrix_iterator_t FirstCandidate(unsigned int dwSignatureNodeId) {
-		iterator itLowerBound = lower_bound(((unsigned long long)dwSignatureNodeId) << 27);
-		while (itLowerBound != end() && (itLowerBound->first >> 27) == dwSignatureNodeId) {
-			unsigned int i;
-			for (i = 0; i < 32; i++) {
-				assignment_t eAssignment = (assignment_t)((itLowerBound->second >> (i << 1)) & 3);
-				if (eAssignment == ASSIGNMENT_VALID || eAssignment == ASSIGNMENT_UNDEFINED) {
-					return sparse_matrix_iterator_t(dwSignatureNodeId, (unsigned int)((itLowerBound->first << 5) | i));
-				}
+	/* add the explored cells of other, on cells explored by both the matrices are expected to agree */
+	inline void Merge(const SparseMatrixImpl &other) {
+		size_t i;
+		if (other.aRows.size() > aRows.size()) {
+			aRows.resize(other.aRows.size());
+		}
+		for (i = 0; i < other.aRows.size(); i++) {
+			MergeRow(aRows[i], other.aRows[i]);
+		}
+	}
+	/* number of candidates of a signature node, counting stops once dwLimit is reached */
+	inline unsigned int CountCandidates(unsigned int dwSignatureNodeId, unsigned int dwLimit = 0xffffffff) const {
+		unsigned int dwCount = 0;
+		if (dwSignatureNodeId < aRows.size()) {
+			const sparse_matrix_row_t &stRow = aRows[dwSignatureNodeId];
+			size_t i;
+			for (i = 0; i < stRow.aCandidate.size() && dwCount < dwLimit; i++) {
+				dwCount += PopCount(stRow.aCandidate[i]);
 			}
-			itLowerBound++;
-		};
-		return sparse_matrix_iterator_t(0xffffffff, 0xffffffff);
+		}
+		return dwCount;
+	}
+	/*
+	 * exchange explored cells of a row with a row kept outside the matrix,
+	 * cells explored on both sides are expected to agree
+	 */
+	inline void SaveRow(unsigned int dwSignatureNodeId, sparse_matrix_row_t &stRow) const {
+		if (dwSignatureNodeId < aRows.size()) {
+			MergeRow(stRow, aRows[dwSignatureNodeId]);
+		}
+	}
+	inline void LoadRow(unsigned int dwSignatureNodeId, const sparse_matrix_row_t &stRow) {
+		if (dwSignatureNodeId >= aRows.size()) {
+			aRows.resize(dwSignatureNodeId + 1);
+		}
+		MergeRow(aRows[dwSignatureNodeId], stRow);
+	}
+	inline sparse_matrix_iterator_t FirstCandidate(unsigned int dwSignatureNodeId) const {
+		return Scan(dwSignatureNodeId, 0);
+	}
+	inline sparse_matrix_iterator_t NextCandidate(const sparse_matrix_iterator_t &it) const {
+		return Scan(it.dwSignatureNodeId, it.dwCodeNodeId + 1);
 	}
 
-	sparse_matrix_iterator_t NextCandidate(const sparse_matrix_iterator_t&it) {
-		iterator itLowerBound = lower_bound(((unsigned long long)it.dwSignatureNodeId << 27) | (it.dwCodeNodeId >> 5));
-		unsigned int i;
-		if (itLowerBound != end() && (itLowerBound->first >> 27) == it.dwSignatureNodeId) {
-			for (i = (it.dwCodeNodeId & 0x1f) + 1; i < 32; i++) {
-				assignment_t eAssignment = (assignment_t)((itLowerBound->second >> (i << 1)) & 3);
-				if (eAssignment == ASSIGNMENT_VALID || eAssignment == ASSIGNMENT_UNDEFINED) {
-					return sparse_matrix_iterator_t(it.dwSignatureNodeId, (unsigned int)((itLowerBound->first << 5) | i));
-				}
+private:
+	/* first candidate of a row with a code node id >= dwCodeNodeId */
+	inline sparse_matrix_iterator_t Scan(unsigned int dwSignatureNodeId, unsigned int dwCodeNodeId) const {
+		if (dwSignatureNodeId < aRows.size()) {
+			const sparse_matrix_row_t &stRow = aRows[dwSignatureNodeId];
+			size_t dwWord = 0;
+			unsigned long long qwMask = ~0ULL;
+
+			if ((dwCodeNodeId >> 6) >= stRow.dwBase) {
+				dwWord = (dwCodeNodeId >> 6) - stRow.dwBase;
+				qwMask = ~0ULL << (dwCodeNodeId & 0x3f);
 			}
-			itLowerBound++;
-			while (itLowerBound != end() && (itLowerBound->first >> 27) == it.dwSignatureNodeId) {
-				for (i = 0; i < 32; i++) {
-					assignment_t eAssignment = (assignment_t)((itLowerBound->second >> (i << 1)) & 3);
-					if (eAssignment == ASSIGNMENT_VALID || eAssignment == ASSIGNMENT_UNDEFINED) {
-						return sparse_matrix_iterator_t(it.dwSignatureNodeId, (unsigned int)((itLowerBound->first << 5) | i));
-					}
+			for (; dwWord < stRow.aCandidate.size(); dwWord++, qwMask = ~0ULL) {
+				unsigned long long qwWord = stRow.aCandidate[dwWord] & qwMask;
+				if (qwWord != 0) {
+					return sparse_matrix_iterator_t(
+						dwSignatureNodeId,
+						(unsigned int)(((stRow.dwBase + dwWord) << 6) | LowestSetBit(qwWord))
+					);
 				}
-				itLowerBound++;
 			}
 		}
 		return sparse_matrix_iterator_t(0xffffffff, 0xffffffff);
 	}
+	inline void Set(unsigned int dwSignatureNodeId, unsigned int dwCodeNodeId, assignment_t eType) {
+		if (dwSignatureNodeId >= aRows.size()) {
+			if (eType == ASSIGNMENT_UNEXPLORED) {
+				return;
+			}
+			aRows.resize(dwSignatureNodeId + 1);
+		}
+		sparse_matrix_row_t &stRow = aRows[dwSignatureNodeId];
+		unsigned int dwWord = dwCodeNodeId >> 6;
+		if (dwWord < stRow.dwBase || dwWord - stRow.dwBase >= stRow.aCandidate.size()) {
+			if (eType == ASSIGNMENT_UNEXPLORED) {
+				return;
+			}
+			Grow(stRow, dwWord);
+		}
+		dwWord -= stRow.dwBase;
+		unsigned long long qwBit = 1ULL << (dwCodeNodeId & 0x3f);
+		if (eType & 2) {
+			stRow.aCandidate[dwWord] |= qwBit;
+		} else {
+			stRow.aCandidate[dwWord] &= ~qwBit;
+		}
+		if (eType & 1) {
+			stRow.aDecided[dwWord] |= qwBit;
+		} else {
+			stRow.aDecided[dwWord] &= ~qwBit;
+		}
+	}
+	static inline void MergeRow(sparse_matrix_row_t &stDestination, const sparse_matrix_row_t &stSource) {
+		size_t i;
+		if (stSource.aCandidate.empty()) {
+			return;
+		}
+		if (stDestination.aCandidate.empty() || stSource.dwBase < stDestination.dwBase) {
+			Grow(stDestination, stSource.dwBase);
+		}
+		if (stSource.dwBase + stSource.aCandidate.size() > stDestination.dwBase + stDestination.aCandidate.size()) {
+			Grow(stDestination, stSource.dwBase + (unsigned int)stSource.aCandidate.size() - 1);
+		}
+		for (i = 0; i < stSource.aCandidate.size(); i++) {
+			stDestination.aCandidate[stSource.dwBase - stDestination.dwBase + i] |= stSource.aCandidate[i];
+			stDestination.aDecided[stSource.dwBase - stDestination.dwBase + i] |= stSource.aDecided[i];
+		}
+	}
+	static inline void Grow(sparse_matrix_row_t &stRow, unsigned int dwWord) {
+		if (stRow.aCandidate.empty()) {
+			stRow.dwBase = dwWord;
+			stRow.aCandidate.resize(1);
+			stRow.aDecided.resize(1);
+		} else if (dwWord < stRow.dwBase) {
+			stRow.aCandidate.insert(stRow.aCandidate.begin(), stRow.dwBase - dwWord, 0);
+			stRow.aDecided.insert(stRow.aDecided.begin(), stRow.dwBase - dwWord, 0);
+			stRow.dwBase = dwWord;
+		} else {
+			stRow.aCandidate.resize(dwWord - stRow.dwBase + 1);
+			stRow.aDecided.resize(dwWord - stRow.dwBase + 1);
+		}
+	}
+
+	std::vector<sparse_matrix_row_t> aRows;
+	std::vector<sparse_matrix_trail_t> aTrail;
+	std::vector<size_t> aMarks; // trail size at each choice point
 };
 
+/* code nodes claimed by a signature node during pass 2, one bit per code node id */
 class FlagMapImpl;
 typedef rfc_ptr<FlagMapImpl> FlagMap;
-class FlagMapImpl : public ReferenceCounted, public std::unordered_map<unsigned int, unsigned long long> {
+class FlagMapImpl : public ReferenceCounted, public std::vector<unsigned long long> {
 public:
-	inline FlagMapImpl() { }
+	inline FlagMapImpl(unsigned int dwNumCodeNodes = 0) : std::vector<unsigned long long>((dwNumCodeNodes + 63) >> 6) { }
 	inline void Assign(unsigned int dwCodeNodeId) {
-		unsigned int dwIndex = dwCodeNodeId >> 5;
-		iterator it = find(dwIndex);
-		if (it != end()) {
-			it->second |= 1ULL << (dwCodeNodeId & 0x3f);
-		} else {
-			insert(std::pair<unsigned int, unsigned long long>(dwIndex, 1 << (dwCodeNodeId & 0x3f)));
+		if ((dwCodeNodeId >> 6) >= size()) {
+			resize((dwCodeNodeId >> 6) + 1);
 		}
+		(*this)[dwCodeNodeId >> 6] |= 1ULL << (dwCodeNodeId & 0x3f);
 	}
 	inline void Unassign(unsigned int dwCodeNodeId) {
-		unsigned int dwIndex = dwCodeNodeId >> 5;
-		iterator it = find(dwIndex);
-		if (it != end()) {
-			it->second &= ~(1 << (dwCodeNodeId & 0x3f));
+		if ((dwCodeNodeId >> 6) < size()) {
+			(*this)[dwCodeNodeId >> 6] &= ~(1ULL << (dwCodeNodeId & 0x3f));
 		}
 	}
-	inline bool IsAssigned(unsigned int dwCodeNodeId) {
-		unsigned int dwIndex = dwCodeNodeId >> 5;
-		iterator it = find(dwIndex);
-		if (it != end()) {
-			return it->second & (1 << dwCodeNodeId & 0x3f);
-		} else {
-			return false;
-		}
+	inline bool IsAssigned(unsigned int dwCodeNodeId) const {
+		return (dwCodeNodeId >> 6) < size() && ((*this)[dwCodeNodeId >> 6] >> (dwCodeNodeId & 0x3f)) & 1;
 	}
 };
 
@@ -212,34 +404,138 @@ public:
 	int dwNumNodes;
 };
 
+/*
+ * candidates of a single pass 2 choice point, handed out to whichever worker asks first.
+ * every worker searches its branches on a private copy of the state at the choice point,
+ * the first match stops all others
+ */
+class SearchSplitImpl : virtual public ReferenceCounted, public ThreadTaskImpl {
+public:
+	SearchSplitImpl(SignatureEvaluatorImpl *lpParent, DFGNode &oSignatureNode, FlagMap &oFlagMap);
+	inline task_kind_t Kind() { return TASK_KIND_SIGNATURE_EVALUATION; }
+	bool Claim(unsigned int *lpCodeNodeId);
+	void Release(AssignmentMap oResult);
+	void Wait();
+
+	/* state at the choice point */
+	SignatureEvaluator oParent;
+	DFGNode oSignatureNode;
+	SparseMatrix oMatrix;
+	OpaqueAssignment oOpaqueAssignment;
+	FlagMap oFlagMap;
+	std::vector<char> aSelected;
+
+	std::vector<unsigned int> aCandidates;
+	std::atomic<bool> bFound;
+	AssignmentMap oMapping; // of the first branch that matched
+
+protected:
+	unsigned long Execute(void *lpPrivate);
+
+private:
+	size_t dwNext;
+	int dwActive; // branches being searched
+	std::mutex stMutex;
+	std::condition_variable stIdle;
+};
+
+/* seeds [dwBegin, dwEnd) of root dwRoot */
+typedef struct candidate_slice_t {
+	unsigned int dwRoot;
+	size_t dwBegin;
+	size_t dwEnd;
+} candidate_slice_t;
+
+/*
+ * pass 1 over a large code graph : the seeds of every root are cut in slices
+ * claimed one by one by the evaluator and idle workers, each filling a private matrix.
+ * pass 1 results don't depend on the order of exploration, so the matrices are simply merged
+ */
+class CandidateScanImpl : virtual public ReferenceCounted, public ThreadTaskImpl {
+public:
+	CandidateScanImpl(SignatureEvaluatorImpl *lpParent);
+	inline task_kind_t Kind() { return TASK_KIND_SIGNATURE_EVALUATION; }
+	bool Claim(unsigned int *lpSlice, bool bRegister);
+	void Scan(SignatureEvaluatorImpl *lpScanner, unsigned int dwSlice);
+	void Merge(SparseMatrix oPartial, const std::vector<unsigned long long> &aPartialVerdicts);
+	void Wait();
+
+	SignatureEvaluator oParent;
+	std::vector<DFGNode> aRoots;
+	std::vector<std::vector<DFGNode>> aSeeds; // of each root
+	std::vector<candidate_slice_t> aSlices;
+	SparseMatrix oInitial; // before pass 1
+	SparseMatrix oMerged;  // filled in by the workers
+	std::vector<unsigned long long> aVerdicts; // new pass 1 failures of the workers
+
+protected:
+	unsigned long Execute(void *lpPrivate);
+
+private:
+	size_t dwNext;
+	int dwActive; // workers yet to merge their matrix
+	std::mutex stMutex;
+	std::condition_variable stIdle;
+};
+
 class SignatureEvaluatorImpl : virtual public ReferenceCounted, public AbstractEvaluatorImpl {
 public:
 	inline SignatureEvaluatorImpl(SignatureDefinition oSignatureDefinition)
-		: oSignatureDefinition(oSignatureDefinition) {}
+		: oSignatureDefinition(oSignatureDefinition), dwVerdictSnapshot(0), dwChoicePoints(0) {}
 
 	SignatureDefinition oSignatureDefinition;
 	Broker oSignatureGraph;
 	SparseMatrix oMatrix;
-	std::multimap<int, unsigned int> aOpaqueIdToNode;
+	MatchPlan oPlan; // of the current variant
 	OpaqueAssignment oOpaqueAssignment;
 	AssignmentMap oMapping;
-	std::list<SparseMatrix> aStack;
+	std::vector<char> aSelected; // signature nodes decided on the current pass 2 path
+	std::vector<sparse_matrix_iterator_t> aRemoved; // candidates removed since the last PruneFlagged
+	std::unordered_map<unsigned int, sparse_matrix_row_t> aClassRows; // pass 1 rows by signature node class, shared by the variants
+	SearchSplit oSplit; // choice point being searched in parallel, if any
+	DFGraph oMatchGraph; // the code graph as reduced for the signatures, see CodeBrokerImpl::MatchGraph
+	VerdictSet oVerdicts; // pass 1 failures seen on sibling paths
+	unsigned int dwVerdictSnapshot; // publication of oVerdicts when the evaluation started, later ones are ignored
+	std::vector<unsigned long long> aPendingVerdicts; // pass 1 failures of the current variant
+	std::vector<unsigned long long> aNewVerdicts; // same, from completed passes only
 	unsigned int dwStartTime;
+	unsigned int dwChoicePoints; // pass 2 choice points with several candidates, see SIGNATURE_SPLIT_CHECK_INTERVAL
 
 	void PushMatrix();
 	void PopMatrix();
 	void ClearFlagged();
 
 	bool Evaluate(AbstractEvaluationResult *lpOutput);
+	inline std::string Identifier() { return oSignatureDefinition->szIdentifier; }
+	inline task_kind_t Kind() { return TASK_KIND_SIGNATURE_EVALUATION; }
 	bool IsCandidate(const DFGNode& oSignatureNode, const DFGNode& oCodeNode);
+	static inline unsigned long long VerdictKey(unsigned int dwClassId, unsigned long long qwConeHash) {
+		return HashCombine(qwConeHash, dwClassId);
+	}
 
 private:
+	bool MatchVariant();
 	assignment_t Pass1Recurse(const DFGNode& oSignatureNode, const DFGNode& oCodeNode);
-	bool Pass2Recurse(
-		FlagMap oFlagMap,
-		DFGraphImpl::const_iterator itE
-	);
+	bool Pass2Recurse(FlagMap oFlagMap);
+	bool Pass2Assign(FlagMap oFlagMap, DFGNode &oSignatureNode);
+	bool Pass2Try(FlagMap oFlagMap, DFGNode &oSignatureNode, unsigned int dwCodeNodeId);
+	bool Pass2Split(FlagMap oFlagMap, DFGNode &oSignatureNode);
+	unsigned int SearchTreeBits();
+	const std::vector<DFGNode> &TypeCandidates(const DFGNode &oSignatureNode);
+	const std::vector<DFGNode> &Seeds(unsigned int dwRoot, std::vector<DFGNode> &aBuffer);
+	void Pass1Parallel();
+	SignatureEvaluator Clone();
+	SignatureEvaluator Branch(SearchSplit oSplit);
+	bool Aborted();
+	DFGNode SelectNode();
+	bool IsSupported(const DFGNode &oSignatureNode, const DFGNode &oCodeNode);
+	void Invalidate(unsigned int dwSignatureNodeId, unsigned int dwCodeNodeId);
+	bool PruneAll();
 	bool PruneFlagged();
+	void ShareRows(bool bLoad);
+
+friend class SearchSplitImpl;
+friend class CandidateScanImpl;
 };
 
 class SignatureEvaluationResultImpl : virtual public ReferenceCounted, public AbstractEvaluationResultImpl {
@@ -1,36 +1,98 @@
+#include <cstring>
+#include <algorithm>
+
+#include "common.hpp"
 #include "ThreadPool.hpp"
 
 std::mutex ThreadPoolImpl::stApiMutex;
+atomic_histogram_t ThreadPoolImpl::stApiLockWait;
+
+static const char *aTaskKindNames[TASK_KIND_MAX] = {
+	"construction",
+	"signature evaluation",
+	"block permutation",
+	"other"
+};
+
+/* identifies the pool and worker slot of the calling thread, if it is a worker */
+static thread_local ThreadPoolImpl *lpCurrentPool = nullptr;
+static thread_local unsigned int dwCurrentWorker = 0;
 
 ThreadTask ThreadTaskImpl::FromFunctionPointer(unsigned long(*lpFunction)(void *)) {
 	return ThreadTask::typecast(rfc_ptr<ThreadTaskLambda>::create(lpFunction));
 }
 
-ThreadPoolImpl::ThreadPoolImpl(int dwNumThreads): dwNumThreads(dwNumThreads), dwNumActive(0) {
+ThreadPoolImpl::ThreadPoolImpl(int dwNumThreads):
+	dwNumThreads(dwNumThreads),
+	dwNumGrouped(0),
+	qwSequence(0),
+	dwNumGlobal(0),
+	lpResultHead(nullptr),
+	bConsumerWaiting(false),
+	dwNumPending(0),
+	dwNumSleeping(0),
+	dwNumActive(0),
+	bExit(false),
+	qwIdleTime(0),
+	qwNumSteals(0),
+	qwLastSample(0),
+	qwSampleInterval(THREAD_POOL_SAMPLE_INTERVAL)
+{
+	qwStartTime = MicroTime();
+	/* only one pool runs at a time, its statistics should not include the previous ones' */
+	stApiLockWait.Reset();
 	if (this->dwNumThreads == 0) {
 		this->dwNumThreads = std::thread::hardware_concurrency();
 		if (this->dwNumThreads == 0) {
 			this->dwNumThreads = 1;
 		}
 	}
+
+	/*
+	 * finished graphs wait in memory until evaluated,
+	 * so evaluation goes first by default
+	 */
+	dVirtualTime = 0;
+	memset(aLanePass, 0, sizeof(aLanePass));
+	SetLaneWeight(TASK_LANE_CONSTRUCTION, 1);
+	SetLaneWeight(TASK_LANE_EVALUATION, 4);
+	SetLaneWeight(TASK_LANE_DISPLAY, 2);
+}
+
+void ThreadPoolImpl::SetLaneWeight(task_lane_t eLane, unsigned int dwWeight) {
+	std::unique_lock<std::mutex> mLock(LockScheduler());
+	aLaneStride[eLane] = 1.0 / (dwWeight == 0 ? 1 : dwWeight);
 }
 
 void ThreadPoolImpl::Schedule(ThreadTask &oTask, void *lpPrivate) {
-	std::unique_lock<std::mutex> mLock(stMutex);
+	task_t stTask(oTask, lpPrivate);
+	Stamp(stTask);
+
+	if (lpCurrentPool == this && PushLocal(stTask)) {
+		/* forked from one of our workers, keep it close */
+		return;
+	}
+
+	std::unique_lock<std::mutex> mLock(LockScheduler());
 
 	InitThreads();
 
-	aTasks.insert(aTasks.end(), task_t(TASK_SPECIAL_NORMAL, oTask, lpPrivate));
+	Enqueue(stTask);
+	dwNumPending++;
 	stCondition.notify_one();
 }
 
-bool ThreadPoolImpl::ScheduleIfResourceAvailable(ThreadTask & oTask, void* lpPrivate) {
-	std::unique_lock<std::mutex> mLock(stMutex);
+bool ThreadPoolImpl::ScheduleIfResourceAvailable(ThreadTask & oTask, void* lpPrivate, bool bOverBudget) {
+	std::unique_lock<std::mutex> mLock(LockScheduler());
 
 	InitThreads();
 
-	if (aTasks.size() < dwNumThreads) {
-		aTasks.insert(aTasks.end(), task_t(TASK_SPECIAL_NORMAL, oTask, lpPrivate));
+	if (bOverBudget ? (dwNumPending == 0 && dwNumActive == 0) : (dwNumPending < dwNumThreads)) {
+		task_t stTask(oTask, lpPrivate);
+		Stamp(stTask);
+		Enqueue(stTask);
+		dwNumPending++;
+		stCondition.notify_one();
 		return true;
 	}
 
@@ -38,50 +100,87 @@ bool ThreadPoolImpl::ScheduleIfResourceAvailable(ThreadTask & oTask, void* lpPri
 }
 
 void ThreadPoolImpl::Synchronize() {
-	std::unique_lock<std::mutex> mLock(stMutex);
-	dwNumSynchronized = 0;
-	aTasks.insert(aTasks.end(), task_t(TASK_SPECIAL_SYNCHRONIZE, ThreadTask(), NULL));
-	stCondition.notify_all();
+	std::unique_lock<std::mutex> mLock(LockScheduler());
 
-	while (dwNumSynchronized != dwNumThreads) {
+	/* wait for all scheduled work (including whatever it spawns) to be done */
+	while (!(dwNumActive == 0 && dwNumPending == 0) && aThreads.begin() != aThreads.end()) {
 		stSynchronize.wait(mLock);
 	}
 }
 
 void ThreadPoolImpl::YieldResult(ThreadTaskResult &oResult) {
-	std::unique_lock<std::mutex> mLock(stMutex);
-	aResults.push_back(oResult);
+	result_node_t *lpNode = new result_node_t;
+	lpNode->oResult = oResult;
+	lpNode->lpNext = lpResultHead.load();
+	while (!lpResultHead.compare_exchange_weak(lpNode->lpNext, lpNode)) { }
 
-	stYield.notify_all();
+	NotifyConsumer();
 }
 
-ThreadTaskResult ThreadPoolImpl::WaitForResult() {
-	std::unique_lock<std::mutex> mLock(stMutex);
+void ThreadPoolImpl::NotifyConsumer() {
+	/* the consumer flags itself before its final check, so this can't miss it */
+	if (bConsumerWaiting) {
+		std::unique_lock<std::mutex> mLock(stResultMutex);
+		stYield.notify_one();
+	}
+}
+
+bool ThreadPoolImpl::DrainResults() {
+	result_node_t *lpNode = lpResultHead.exchange(nullptr);
+	std::list<ThreadTaskResult>::iterator itInsert = aResults.end();
+
+	/* the stack holds the newest result first, insert in reverse to restore yield order */
+	while (lpNode != nullptr) {
+		result_node_t *lpNext = lpNode->lpNext;
+		itInsert = aResults.insert(itInsert, lpNode->oResult);
+		delete lpNode;
+		lpNode = lpNext;
+	}
+	return aResults.begin() != aResults.end();
+}
 
-	while (
-		!( /* continue down below if: */
-			aResults.begin() != aResults.end() || ( // a result is yielded, or:
-				dwNumActive == 0 && // all threads are idle, and
-				aTasks.begin() == aTasks.end() // no tasks are currently scheduled
+size_t ThreadPoolImpl::WaitForResults(std::list<ThreadTaskResult> &aOutput, size_t dwMaxResults) {
+	size_t dwNumResults = 0;
+
+	if (aResults.begin() == aResults.end() && !DrainResults()) {
+		std::unique_lock<std::mutex> mLock(stResultMutex);
+		bConsumerWaiting = true;
+		while (
+			!( /* continue down below if: */
+				DrainResults() || ( // a result is yielded, or:
+					dwNumActive == 0 && // all threads are idle, and
+					dwNumPending == 0 // no tasks are currently scheduled
+				)
 			)
-		)
-	) {
-		stYield.wait(mLock);
+		) {
+			stYield.wait(mLock);
+		}
+		bConsumerWaiting = false;
+		/* a result may have been yielded right before the pool went idle */
+		DrainResults();
 	}
 
-	if (aResults.begin() != aResults.end()) {
-		ThreadTaskResult oResult = *aResults.begin();
+	while (aResults.begin() != aResults.end() && dwNumResults < dwMaxResults) {
+		aOutput.push_back(*aResults.begin());
 		aResults.pop_front();
-		return oResult;
-	} else {
+		dwNumResults++;
+	}
+	return dwNumResults;
+}
+
+ThreadTaskResult ThreadPoolImpl::WaitForResult() {
+	std::list<ThreadTaskResult> aOutput;
+
+	if (WaitForResults(aOutput, 1) == 0) {
 		return nullptr;
 	}
+	return *aOutput.begin();
 }
 
 ThreadPoolImpl::~ThreadPoolImpl() {
 	{
-		std::unique_lock<std::mutex> mLock(stMutex);
-		aTasks.insert(aTasks.end(), task_t(TASK_SPECIAL_EXIT, ThreadTask(), NULL));
+		std::unique_lock<std::mutex> mLock(LockScheduler());
+		bExit = true;
 		stCondition.notify_all();
 	}
 
@@ -89,44 +188,314 @@ ThreadPoolImpl::~ThreadPoolImpl() {
 	for (it = aThreads.begin(); it != aThreads.end(); it++) {
 		it->join();
 	}
+
+	std::vector<worker_t *>::iterator itW;
+	for (itW = aWorkers.begin(); itW != aWorkers.end(); itW++) {
+		delete *itW;
+	}
+	DrainResults();
 }
 
-void ThreadPoolImpl::Worker() {
+void ThreadPoolImpl::Worker(unsigned int dwIndex) {
+	lpCurrentPool = this;
+	dwCurrentWorker = dwIndex;
+
 	for (;;) {
 		task_t stTask;
-		{
-			std::unique_lock<std::mutex> mLock(stMutex);
-			while (aTasks.begin() == aTasks.end()) {
-				dwNumActive--;
-				if (dwNumActive == 0) {
-					stYield.notify_all();
-				}
-				stCondition.wait(mLock);
-				dwNumActive++;
+
+		if (!NextTask(dwIndex, stTask)) {
+			std::unique_lock<std::mutex> mLock(LockScheduler());
+			if (bExit) {
+				break;
 			}
-			stTask = *aTasks.begin();
-
-			if (stTask.eSpecial == TASK_SPECIAL_SYNCHRONIZE) {
-				dwNumSynchronized++;
-
-				if (dwNumSynchronized == dwNumThreads) {
-					/* we're the last thread that hits this code -> notify others and clean */
-					stSynchronize.notify_all();
-					aTasks.pop_front();
-				}
-				while(dwNumSynchronized != dwNumThreads) {
-					stSynchronize.wait(mLock);
-				}
+			/*
+			 * announce we're about to sleep before checking for work one last time,
+			 * WakeWorker does the opposite : publish work, then check for sleepers
+			 */
+			dwNumSleeping++;
+			if (dwNumPending != 0) {
+				/* work is still around, possibly in a local heap that is being emptied */
+				dwNumSleeping--;
+				mLock.unlock();
+				std::this_thread::yield();
 				continue;
-			} else if (stTask.eSpecial == TASK_SPECIAL_EXIT) {
+			}
+			if (--dwNumActive == 0) {
+				stSynchronize.notify_all();
+				std::unique_lock<std::mutex> mResultLock(stResultMutex);
+				stYield.notify_all();
+			}
+			/* idle workers may stay asleep until the statistics are dumped */
+			FlushUncontended(aWorkers[dwIndex]);
+			unsigned long long qwSleepTime = MicroTime();
+			while (!bExit && dwNumPending == 0) {
+				stCondition.wait(mLock);
+			}
+			qwIdleTime += MicroTime() - qwSleepTime;
+			dwNumActive++;
+			dwNumSleeping--;
+			if (bExit) {
 				break;
-			} else {
-				aTasks.pop_front();
-				/* fall through */
 			}
+			continue;
 		}
 
+		unsigned long long qwRunTime = MicroTime();
+		aQueueLatency[stTask.eKind].Add(qwRunTime - stTask.qwEnqueueTime);
 		stTask.oTask->Execute(stTask.lpPrivate);
+		unsigned long long qwDoneTime = MicroTime();
+		aRunTime[stTask.eKind].Add(qwDoneTime - qwRunTime);
+		SampleQueue(qwDoneTime);
+
+		if (stTask.bGroupRunning) {
+			std::unique_lock<std::mutex> mLock(LockScheduler());
+			TaskDone(stTask);
+		}
+	}
+	FlushUncontended(aWorkers[dwIndex]);
+}
+
+bool ThreadPoolImpl::PushLocal(task_t &stTask) {
+	worker_t *lpWorker = aWorkers[dwCurrentWorker];
+	if (stTask.oTask->Lane() != TASK_LANE_CONSTRUCTION) {
+		/* local heaps only hold construction work, see Dequeue */
+		return false;
+	}
+	stTask.eLane = TASK_LANE_CONSTRUCTION;
+	stTask.lpGroup = stTask.oTask->TaskGroup();
+	stTask.dPriority = stTask.oTask->Priority();
+	stTask.qwSequence = qwSequence++;
+	{
+		std::unique_lock<std::mutex> mLock(lpWorker->stMutex);
+		if (lpWorker->aHeap.size() >= THREAD_POOL_MAX_LOCAL_TASKS) {
+			/* spill over to the shared scheduler */
+			return false;
+		}
+		lpWorker->aHeap.push_back(stTask);
+		std::push_heap(lpWorker->aHeap.begin(), lpWorker->aHeap.end());
+	}
+	dwNumPending++;
+	WakeWorker();
+	return true;
+}
+
+bool ThreadPoolImpl::NextTask(unsigned int dwIndex, task_t &stTask) {
+	task_t stLocal;
+	bool bLocal = PeekLocal(dwIndex, stLocal);
+
+	if (dwNumGlobal != 0) {
+		std::unique_lock<std::mutex> mLock(LockScheduler());
+		if (Dequeue(stTask, bLocal ? &stLocal : NULL)) {
+			dwNumPending--;
+			return true;
+		}
+	}
+	return PopLocal(dwIndex, stTask) || Steal(dwIndex, stTask);
+}
+
+/* copy of the best local task, if any */
+bool ThreadPoolImpl::PeekLocal(unsigned int dwIndex, task_t &stTask) {
+	worker_t *lpWorker = aWorkers[dwIndex];
+	std::unique_lock<std::mutex> mLock(lpWorker->stMutex);
+	if (lpWorker->aHeap.empty()) {
+		return false;
+	}
+	stTask = lpWorker->aHeap.front();
+	return true;
+}
+
+bool ThreadPoolImpl::PopLocal(unsigned int dwIndex, task_t &stTask) {
+	worker_t *lpWorker = aWorkers[dwIndex];
+	{
+		std::unique_lock<std::mutex> mLock(lpWorker->stMutex);
+		if (lpWorker->aHeap.empty()) {
+			return false;
+		}
+		std::pop_heap(lpWorker->aHeap.begin(), lpWorker->aHeap.end());
+		stTask = lpWorker->aHeap.back();
+		lpWorker->aHeap.pop_back();
+	}
+	dwNumPending--;
+
+	std::unique_lock<std::mutex> mLock(LockScheduler());
+	Charge(stTask);
+	return true;
+}
+
+/*
+ * the best local task of all other workers, scored like the group queues (see Dequeue),
+ * so stealing doesn't hand every worker to the same exploding function either
+ */
+bool ThreadPoolImpl::Steal(unsigned int dwIndex, task_t &stTask) {
+	worker_t *lpBest = NULL;
+	double dBest = 0;
+	task_t stTop;
+	unsigned int i;
+
+	std::unique_lock<std::mutex> mLock(LockScheduler());
+	for (i = 1; i < aWorkers.size(); i++) {
+		unsigned int dwVictim = (dwIndex + i) % aWorkers.size();
+		if (PeekLocal(dwVictim, stTop) && (lpBest == NULL || Score(stTop) > dBest)) {
+			lpBest = aWorkers[dwVictim];
+			dBest = Score(stTop);
+		}
+	}
+	if (lpBest == NULL) {
+		return false;
+	}
+	{
+		std::unique_lock<std::mutex> mVictimLock(lpBest->stMutex);
+		if (lpBest->aHeap.empty()) {
+			/* its owner was faster */
+			return false;
+		}
+		std::pop_heap(lpBest->aHeap.begin(), lpBest->aHeap.end());
+		stTask = lpBest->aHeap.back();
+		lpBest->aHeap.pop_back();
+	}
+	dwNumPending--;
+	qwNumSteals++;
+	Charge(stTask);
+	return true;
+}
+
+void ThreadPoolImpl::WakeWorker() {
+	if (dwNumSleeping != 0) {
+		std::unique_lock<std::mutex> mLock(LockScheduler());
+		stCondition.notify_one();
+	}
+}
+
+void ThreadPoolImpl::Enqueue(task_t &stTask) {
+	stTask.eLane = stTask.oTask->Lane();
+	stTask.lpGroup = stTask.oTask->TaskGroup();
+	stTask.qwSequence = qwSequence++;
+
+	if (aTasks[stTask.eLane].begin() == aTasks[stTask.eLane].end() && aLanePass[stTask.eLane] < dVirtualTime) {
+		/* an idle lane doesn't build up credit */
+		aLanePass[stTask.eLane] = dVirtualTime;
+	}
+	dwNumGlobal++;
+	if (stTask.eLane != TASK_LANE_CONSTRUCTION || stTask.lpGroup == 0) {
+		aTasks[stTask.eLane].insert(aTasks[stTask.eLane].end(), stTask);
+		return;
+	}
+
+	std::unordered_map<unsigned long, task_group_t>::iterator it = aGroups.find(stTask.lpGroup);
+	if (it == aGroups.end()) {
+		task_group_t stGroup;
+		stGroup.dwNumRunning = 0;
+		it = aGroups.insert(std::pair<unsigned long, task_group_t>(stTask.lpGroup, stGroup)).first;
+	}
+	stTask.dPriority = stTask.oTask->Priority();
+	it->second.aQueue.push(stTask);
+	dwNumGrouped++;
+}
+
+/*
+ * stride scheduling across lanes : the non-empty lane that has consumed least
+ * relative to its weight goes next. the calling worker's best local task (lpLocal) counts as
+ * construction work, false is returned with the lane charged when it should run next
+ */
+bool ThreadPoolImpl::Dequeue(task_t &stTask, const task_t *lpLocal) {
+	std::unordered_map<unsigned long, task_group_t>::iterator itBest;
+	double dBest = 0;
+	int i, dwLane = -1;
+
+	for (i = 0; i < TASK_LANE_MAX; i++) {
+		bool bNonEmpty = aTasks[i].begin() != aTasks[i].end() ||
+			(i == TASK_LANE_CONSTRUCTION && (dwNumGrouped != 0 || lpLocal != NULL));
+		if (bNonEmpty && (dwLane == -1 || aLanePass[i] < aLanePass[dwLane])) {
+			dwLane = i;
+		}
+	}
+	if (dwLane == -1) {
+		return false;
+	}
+	dVirtualTime = aLanePass[dwLane];
+	aLanePass[dwLane] += aLaneStride[dwLane];
+
+	if (dwLane == TASK_LANE_CONSTRUCTION && lpLocal != NULL) {
+		/* own work first, unless another group's best task scores higher */
+		itBest = BestGroup(&dBest);
+		if (itBest == aGroups.end() || dBest <= Score(*lpLocal)) {
+			return false;
+		}
+		goto _take_group;
+	}
+	if (aTasks[dwLane].begin() != aTasks[dwLane].end()) {
+		stTask = *aTasks[dwLane].begin();
+		aTasks[dwLane].pop_front();
+		dwNumGlobal--;
+		return true;
+	}
+
+	itBest = BestGroup(&dBest);
+	if (itBest == aGroups.end()) {
+		return false;
+	}
+
+_take_group:
+	stTask = itBest->second.aQueue.top();
+	itBest->second.aQueue.pop();
+	itBest->second.dwNumRunning++;
+	stTask.bGroupRunning = true;
+	dwNumGrouped--;
+	dwNumGlobal--;
+	return true;
+}
+
+/*
+ * best-first across groups, but a group's best task is weighed down
+ * by the number of its tasks already running, so one exploding function
+ * can't claim all workers while others are waiting
+ */
+std::unordered_map<unsigned long, task_group_t>::iterator ThreadPoolImpl::BestGroup(double *lpScore) {
+	std::unordered_map<unsigned long, task_group_t>::iterator it, itBest = aGroups.end();
+
+	for (it = aGroups.begin(); it != aGroups.end(); it++) {
+		if (it->second.aQueue.empty()) {
+			continue;
+		}
+		double dScore = it->second.aQueue.top().dPriority / (1 + it->second.dwNumRunning);
+		if (itBest == aGroups.end() || dScore > *lpScore ||
+			(dScore == *lpScore && it->second.aQueue.top().qwSequence < itBest->second.aQueue.top().qwSequence)
+		) {
+			itBest = it;
+			*lpScore = dScore;
+		}
+	}
+	return itBest;
+}
+
+/* same weighing for a task outside the group queues */
+double ThreadPoolImpl::Score(const task_t &stTask) {
+	std::unordered_map<unsigned long, task_group_t>::iterator it = aGroups.find(stTask.lpGroup);
+	return stTask.dPriority / (1 + (it == aGroups.end() ? 0 : it->second.dwNumRunning));
+}
+
+/* a local task starts running, see TaskDone */
+void ThreadPoolImpl::Charge(task_t &stTask) {
+	if (stTask.lpGroup == 0) {
+		return;
+	}
+	std::unordered_map<unsigned long, task_group_t>::iterator it = aGroups.find(stTask.lpGroup);
+	if (it == aGroups.end()) {
+		task_group_t stGroup;
+		stGroup.dwNumRunning = 0;
+		it = aGroups.insert(std::pair<unsigned long, task_group_t>(stTask.lpGroup, stGroup)).first;
+	}
+	it->second.dwNumRunning++;
+	stTask.bGroupRunning = true;
+}
+
+void ThreadPoolImpl::TaskDone(task_t &stTask) {
+	std::unordered_map<unsigned long, task_group_t>::iterator it = aGroups.find(stTask.lpGroup);
+	if (it == aGroups.end()) {
+		return;
+	}
+	if (--it->second.dwNumRunning == 0 && it->second.aQueue.empty()) {
+		aGroups.erase(it);
 	}
 }
 
@@ -135,7 +504,11 @@ void ThreadPoolImpl::InitThreads() {
 		int i;
 		dwNumActive = dwNumThreads;
 		for (i = 0; i < dwNumThreads; i++) {
-			aThreads.insert(aThreads.end(), std::thread(&ThreadPoolImpl::Worker, this));
+			aWorkers.push_back(new worker_t);
+			memset(aWorkers.back()->aUncontended, 0, sizeof(aWorkers.back()->aUncontended));
+		}
+		for (i = 0; i < dwNumThreads; i++) {
+			aThreads.insert(aThreads.end(), std::thread(&ThreadPoolImpl::Worker, this, i));
 		}
 	}
 }
@@ -146,4 +519,215 @@ inline void *ThreadTaskResultImpl::toVoidPointer() {
 
 ThreadTaskResult ThreadTaskResultImpl::FromVoidPointer(void *lpResult) {
 	return ThreadTaskResult::typecast(rfc_ptr<ThreadTaskResultVoidPointerImpl>::create(lpResult));
-}
\ No newline at end of file
+}
+
+void ThreadPoolImpl::ApiLock() {
+	if (stApiMutex.try_lock()) {
+		CountUncontended(lpCurrentPool, POOL_LOCK_API);
+		return;
+	}
+	unsigned long long qwStart = MicroTime();
+	stApiMutex.lock();
+	stApiLockWait.Add(MicroTime() - qwStart);
+}
+
+std::unique_lock<std::mutex> ThreadPoolImpl::LockScheduler() {
+	std::unique_lock<std::mutex> mLock(stMutex, std::try_to_lock);
+	if (mLock.owns_lock()) {
+		CountUncontended(this, POOL_LOCK_SCHEDULER);
+		return mLock;
+	}
+	unsigned long long qwStart = MicroTime();
+	mLock.lock();
+	stSchedulerLockWait.Add(MicroTime() - qwStart);
+	return mLock;
+}
+
+/*
+ * workers of lpPool tally their uncontended acquisitions in their own slot,
+ * other threads (or workers of another pool) add theirs right away
+ */
+void ThreadPoolImpl::CountUncontended(ThreadPoolImpl *lpPool, pool_lock_t eLock) {
+	if (lpPool == nullptr || lpCurrentPool != lpPool) {
+		(eLock == POOL_LOCK_API ? stApiLockWait : lpPool->stSchedulerLockWait).AddUncontended(1);
+		return;
+	}
+	worker_t *lpWorker = lpPool->aWorkers[dwCurrentWorker];
+	if (++lpWorker->aUncontended[eLock] == THREAD_POOL_UNCONTENDED_BATCH) {
+		lpPool->FlushUncontended(lpWorker);
+	}
+}
+
+/* owner of the slot only */
+void ThreadPoolImpl::FlushUncontended(worker_t *lpWorker) {
+	if (lpWorker->aUncontended[POOL_LOCK_SCHEDULER] != 0) {
+		stSchedulerLockWait.AddUncontended(lpWorker->aUncontended[POOL_LOCK_SCHEDULER]);
+		lpWorker->aUncontended[POOL_LOCK_SCHEDULER] = 0;
+	}
+	if (lpWorker->aUncontended[POOL_LOCK_API] != 0) {
+		stApiLockWait.AddUncontended(lpWorker->aUncontended[POOL_LOCK_API]);
+		lpWorker->aUncontended[POOL_LOCK_API] = 0;
+	}
+}
+
+void ThreadPoolImpl::Stamp(task_t &stTask) {
+	stTask.eKind = stTask.oTask->Kind();
+	stTask.qwEnqueueTime = MicroTime();
+}
+
+void ThreadPoolImpl::SampleQueue(unsigned long long qwNow) {
+	unsigned long long qwLast = qwLastSample;
+	if (qwNow - qwLast < qwSampleInterval || !qwLastSample.compare_exchange_strong(qwLast, qwNow)) {
+		/* too early, or another worker is taking this sample */
+		return;
+	}
+
+	std::unique_lock<std::mutex> mLock(stStatisticsMutex);
+	if (aQueueSamples.size() >= THREAD_POOL_MAX_QUEUE_SAMPLES) {
+		/* keep every other sample, halving the resolution */
+		size_t i;
+		for (i = 0; 2 * i < aQueueSamples.size(); i++) {
+			aQueueSamples[i] = aQueueSamples[2 * i];
+		}
+		aQueueSamples.resize(i);
+		qwSampleInterval = 2 * qwSampleInterval;
+	}
+	queue_sample_t stSample;
+	stSample.qwTime = qwNow - qwStartTime;
+	stSample.dwNumPending = dwNumPending;
+	stSample.dwNumActive = dwNumActive;
+	aQueueSamples.push_back(stSample);
+}
+
+void ThreadPoolImpl::GetStatistics(thread_pool_statistics_t &stStatistics) {
+	int i;
+	if (lpCurrentPool == this) {
+		FlushUncontended(aWorkers[dwCurrentWorker]);
+	}
+	for (i = 0; i < TASK_KIND_MAX; i++) {
+		aQueueLatency[i].Snapshot(stStatistics.aQueueLatency[i]);
+		aRunTime[i].Snapshot(stStatistics.aRunTime[i]);
+	}
+	stSchedulerLockWait.Snapshot(stStatistics.aLockWait[POOL_LOCK_SCHEDULER]);
+	stApiLockWait.Snapshot(stStatistics.aLockWait[POOL_LOCK_API]);
+	stStatistics.qwIdleTime = qwIdleTime;
+	stStatistics.qwNumSteals = qwNumSteals;
+	stStatistics.qwUptime = MicroTime() - qwStartTime;
+
+	std::unique_lock<std::mutex> mLock(stStatisticsMutex);
+	stStatistics.aQueueSamples = aQueueSamples;
+}
+
+static void DumpHistogram(const char *szName, const histogram_t &stHistogram) {
+	if (stHistogram.qwCount == 0) {
+		return;
+	}
+	wc_debug("    %-28s n=%llu mean=%lluus p50<%lluus p99<%lluus max=%lluus\n",
+		szName,
+		stHistogram.qwCount,
+		stHistogram.qwTotal / stHistogram.qwCount,
+		stHistogram.Percentile(0.5),
+		stHistogram.Percentile(0.99),
+		stHistogram.qwMax
+	);
+}
+
+void ThreadPoolImpl::DumpStatistics() {
+	thread_pool_statistics_t stStatistics;
+	std::vector<queue_sample_t>::iterator it;
+	size_t dwStep;
+	int i, dwMaxPending = 0;
+
+	GetStatistics(stStatistics);
+
+	wc_debug("[*] thread pool statistics (%d threads, up %.1fs, idle %.1f%%, %llu steals)\n",
+		dwNumThreads,
+		(double)stStatistics.qwUptime / 1000000,
+		stStatistics.qwUptime == 0 ? 0.0 : 100.0 * stStatistics.qwIdleTime / ((double)stStatistics.qwUptime * dwNumThreads),
+		stStatistics.qwNumSteals
+	);
+	wc_debug("  queue latency\n");
+	for (i = 0; i < TASK_KIND_MAX; i++) {
+		DumpHistogram(aTaskKindNames[i], stStatistics.aQueueLatency[i]);
+	}
+	wc_debug("  run time\n");
+	for (i = 0; i < TASK_KIND_MAX; i++) {
+		DumpHistogram(aTaskKindNames[i], stStatistics.aRunTime[i]);
+	}
+	wc_debug("  lock wait\n");
+	DumpHistogram("scheduler", stStatistics.aLockWait[POOL_LOCK_SCHEDULER]);
+	DumpHistogram("IDA API", stStatistics.aLockWait[POOL_LOCK_API]);
+
+	for (it = stStatistics.aQueueSamples.begin(); it != stStatistics.aQueueSamples.end(); it++) {
+		if (it->dwNumPending > dwMaxPending) {
+			dwMaxPending = it->dwNumPending;
+		}
+	}
+	wc_debug("  queue depth (%lu samples, max %d pending)\n", (unsigned long)stStatistics.aQueueSamples.size(), dwMaxPending);
+	/* no more than 32 lines */
+	dwStep = stStatistics.aQueueSamples.size() / 32 + 1;
+	for (it = stStatistics.aQueueSamples.begin(); it < stStatistics.aQueueSamples.end(); it += dwStep) {
+		wc_debug("    %8.1fs pending=%d active=%d\n", (double)it->qwTime / 1000000, it->dwNumPending, it->dwNumActive);
+		if ((size_t)(stStatistics.aQueueSamples.end() - it) <= dwStep) {
+			break;
+		}
+	}
+}
+
+atomic_histogram_t::atomic_histogram_t() : qwCount(0), qwTotal(0), qwMax(0) {
+	int i;
+	for (i = 0; i < THREAD_POOL_HISTOGRAM_BUCKETS; i++) {
+		aBuckets[i] = 0;
+	}
+}
+
+void atomic_histogram_t::Add(unsigned long long qwMicros) {
+	unsigned long long qwPrevious = qwMax.load(std::memory_order_relaxed);
+	int dwBucket = 0;
+
+	while (qwMicros >> dwBucket && dwBucket < THREAD_POOL_HISTOGRAM_BUCKETS - 1) {
+		dwBucket++;
+	}
+	aBuckets[dwBucket].fetch_add(1, std::memory_order_relaxed);
+	qwCount.fetch_add(1, std::memory_order_relaxed);
+	qwTotal.fetch_add(qwMicros, std::memory_order_relaxed);
+	while (qwMicros > qwPrevious && !qwMax.compare_exchange_weak(qwPrevious, qwMicros)) { }
+}
+
+void atomic_histogram_t::AddUncontended(unsigned long long qwCount) {
+	aBuckets[0].fetch_add(qwCount, std::memory_order_relaxed);
+	this->qwCount.fetch_add(qwCount, std::memory_order_relaxed);
+}
+
+void atomic_histogram_t::Reset() {
+	int i;
+	for (i = 0; i < THREAD_POOL_HISTOGRAM_BUCKETS; i++) {
+		aBuckets[i] = 0;
+	}
+	qwCount = 0;
+	qwTotal = 0;
+	qwMax = 0;
+}
+
+void atomic_histogram_t::Snapshot(histogram_t &stOutput) const {
+	int i;
+	for (i = 0; i < THREAD_POOL_HISTOGRAM_BUCKETS; i++) {
+		stOutput.aBuckets[i] = aBuckets[i];
+	}
+	stOutput.qwCount = qwCount;
+	stOutput.qwTotal = qwTotal;
+	stOutput.qwMax = qwMax;
+}
+
+/* upper bound (bucket limit) below which the given fraction of the samples lies */
+unsigned long long histogram_t::Percentile(double dFraction) const {
+	unsigned long long qwSeen = 0;
+	int i;
+	for (i = 0; i < THREAD_POOL_HISTOGRAM_BUCKETS; i++) {
+		qwSeen += aBuckets[i];
+		if (qwSeen >= dFraction * qwCount) {
+			break;
+		}
+	}
+	return 1ULL << (i < THREAD_POOL_HISTOGRAM_BUCKETS ? i : THREAD_POOL_HISTOGRAM_BUCKETS - 1);
+}
@@ -1,33 +1,144 @@
 #pragma once
 
 #include <list>
+#include <queue>
+#include <vector>
+#include <unordered_map>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <chrono>
 
 #include "types.hpp"
 
-#define API_LOCK() ThreadPoolImpl::stApiMutex.lock()
+#define API_LOCK() ThreadPoolImpl::ApiLock()
 #define API_UNLOCK() ThreadPoolImpl::stApiMutex.unlock()
 
 #define THREAD_RESULT_TYPE_VOID 0x210cba4b
 
+/* tasks a worker keeps for itself before spilling to the shared scheduler */
+#define THREAD_POOL_MAX_LOCAL_TASKS 64
+
+/*
+ * kinds of work, each with a queue of its own.
+ * lanes share the workers in proportion to their weight (see SetLaneWeight)
+ */
+typedef enum {
+	TASK_LANE_CONSTRUCTION = 0,
+	TASK_LANE_EVALUATION,
+	TASK_LANE_DISPLAY,
+	TASK_LANE_MAX
+} task_lane_t;
+
+/* what a task does, for statistics only */
 typedef enum {
-	TASK_SPECIAL_NORMAL = 0,
-	TASK_SPECIAL_SYNCHRONIZE,
-	TASK_SPECIAL_EXIT
-} task_special_t;
+	TASK_KIND_CONSTRUCTION = 0,
+	TASK_KIND_SIGNATURE_EVALUATION,
+	TASK_KIND_BLOCK_PERMUTATION,
+	TASK_KIND_OTHER,
+	TASK_KIND_MAX
+} task_kind_t;
+
+typedef enum {
+	POOL_LOCK_SCHEDULER = 0, // stMutex
+	POOL_LOCK_API,           // stApiMutex
+	POOL_LOCK_MAX
+} pool_lock_t;
+
+/* bucket i counts durations of [2^(i-1), 2^i) microseconds, bucket 0 those below 1us */
+#define THREAD_POOL_HISTOGRAM_BUCKETS 40
+/* uncontended lock acquisitions of a worker are tallied in its slot, and published once this many have piled up */
+#define THREAD_POOL_UNCONTENDED_BATCH 256
+/* queue depth is sampled every THREAD_POOL_SAMPLE_INTERVAL us, the interval doubles when the samples are full */
+#define THREAD_POOL_SAMPLE_INTERVAL 100000
+#define THREAD_POOL_MAX_QUEUE_SAMPLES 4096
+
+typedef struct histogram_t {
+	unsigned long long aBuckets[THREAD_POOL_HISTOGRAM_BUCKETS];
+	unsigned long long qwCount;
+	unsigned long long qwTotal; // us
+	unsigned long long qwMax;   // us
+	unsigned long long Percentile(double dFraction) const;
+} histogram_t;
+
+/* histogram_t updated concurrently by the workers */
+class atomic_histogram_t {
+public:
+	atomic_histogram_t();
+	void Add(unsigned long long qwMicros);
+	/* qwCount waits below 1us at once */
+	void AddUncontended(unsigned long long qwCount);
+	void Snapshot(histogram_t &stOutput) const;
+	void Reset();
+
+private:
+	std::atomic<unsigned long long> aBuckets[THREAD_POOL_HISTOGRAM_BUCKETS];
+	std::atomic<unsigned long long> qwCount;
+	std::atomic<unsigned long long> qwTotal;
+	std::atomic<unsigned long long> qwMax;
+};
+
+typedef struct queue_sample_t {
+	unsigned long long qwTime; // us since the pool was created
+	int dwNumPending;
+	int dwNumActive;
+} queue_sample_t;
+
+typedef struct thread_pool_statistics_t {
+	histogram_t aQueueLatency[TASK_KIND_MAX];
+	histogram_t aRunTime[TASK_KIND_MAX];
+	histogram_t aLockWait[POOL_LOCK_MAX];
+	unsigned long long qwIdleTime; // us, summed over all workers
+	unsigned long long qwNumSteals;
+	unsigned long long qwUptime;   // us
+	std::vector<queue_sample_t> aQueueSamples;
+} thread_pool_statistics_t;
 
 class task_t {
 public:
-	task_special_t eSpecial;
 	ThreadTask oTask;
 	void *lpPrivate;
+	task_kind_t eKind;
+	unsigned long long qwEnqueueTime; // us
+	task_lane_t eLane;
+	unsigned long lpGroup;
+	double dPriority;
+	unsigned long long qwSequence;
+	bool bGroupRunning; // counted as running in its group (see TaskDone)
+
+	inline task_t(ThreadTask &oTask, void *lpPrivate)
+		: oTask(oTask), lpPrivate(lpPrivate), eKind(TASK_KIND_OTHER), qwEnqueueTime(0), eLane(TASK_LANE_EVALUATION), lpGroup(0), dPriority(0), qwSequence(0), bGroupRunning(false) { }
+	inline task_t() : eKind(TASK_KIND_OTHER), qwEnqueueTime(0), eLane(TASK_LANE_EVALUATION), lpGroup(0), dPriority(0), qwSequence(0), bGroupRunning(false) { }
 
-	inline task_t(task_special_t eSpecial, ThreadTask &oTask, void *lpPrivate)
-		: eSpecial(eSpecial), oTask(oTask), lpPrivate(lpPrivate) { }
-	inline task_t() { }
+	/* std::priority_queue pops the largest : highest priority first, oldest first among equals */
+	inline bool operator<(const task_t &other) const {
+		return dPriority != other.dPriority ? dPriority < other.dPriority : qwSequence > other.qwSequence;
+	}
 };
 
+/* node of the lock-free result stack, see YieldResult */
+typedef struct result_node_t {
+	ThreadTaskResult oResult;
+	struct result_node_t *lpNext;
+} result_node_t;
+
+/*
+ * tasks spawned by a worker, a heap ordered like the group queues (see task_t::operator<).
+ * they count as running in their group once taken, by the owner or by a thief
+ */
+typedef struct {
+	std::vector<task_t> aHeap;
+	std::mutex stMutex;
+	unsigned int aUncontended[POOL_LOCK_MAX]; // not yet in the lock histograms, only touched by the owner (see FlushUncontended)
+} worker_t;
+
+/* pending tasks of a single group (e.g. all paths of one function) */
+typedef struct {
+	std::priority_queue<task_t> aQueue;
+	int dwNumRunning;
+} task_group_t;
+
 class ThreadTaskResultImpl : virtual public ReferenceCounted {
 public:
 	inline ThreadTaskResultImpl(unsigned int dwType): dwType(dwType) { }
@@ -50,6 +161,11 @@ public:
 	inline ThreadTaskImpl() { }
 	static ThreadTask FromFunctionPointer(unsigned long(*lpFunction)(void *));
 	inline ThreadTask toThreadTask() { return ThreadTask::typecast(this); };
+	virtual task_lane_t Lane() { return TASK_LANE_EVALUATION; }
+	virtual task_kind_t Kind() { return TASK_KIND_OTHER; }
+	/* construction tasks of the same group are ordered by priority, groups share the workers fairly; 0 = plain FIFO */
+	virtual unsigned long TaskGroup() { return 0; }
+	virtual double Priority() { return 0.0; }
 
 protected:
 	virtual unsigned long Execute(void *lpPrivate) = 0;
@@ -71,23 +187,86 @@ public:
 	ThreadPoolImpl(int dwNumThreads = 0);
 	~ThreadPoolImpl();
 	void Schedule(ThreadTask &, void *lpPrivate);
-	bool ScheduleIfResourceAvailable(ThreadTask&, void* lpPrivate);
+	/* when over budget, the task is only admitted if the pool has nothing else to do */
+	bool ScheduleIfResourceAvailable(ThreadTask&, void* lpPrivate, bool bOverBudget = false);
 	void Synchronize();
 	void YieldResult(ThreadTaskResult &oResult);
 	ThreadTaskResult WaitForResult();
+	void SetLaneWeight(task_lane_t eLane, unsigned int dwWeight);
+	size_t WaitForResults(std::list<ThreadTaskResult> &aOutput, size_t dwMaxResults);
+	void GetStatistics(thread_pool_statistics_t &stStatistics);
+	void DumpStatistics();
 
+	static void ApiLock();
+	static inline unsigned long long MicroTime() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
 	static std::mutex stApiMutex;
 	int dwNumThreads;
 private:
-	void Worker();
+	std::unique_lock<std::mutex> LockScheduler();
+	static void CountUncontended(ThreadPoolImpl *lpPool, pool_lock_t eLock);
+	void FlushUncontended(worker_t *lpWorker);
+	void Stamp(task_t &stTask);
+	void SampleQueue(unsigned long long qwNow);
+	void Worker(unsigned int dwIndex);
 	void InitThreads();
-	std::list<task_t> aTasks;
+	void Enqueue(task_t &stTask);
+	bool Dequeue(task_t &stTask, const task_t *lpLocal);
+	std::unordered_map<unsigned long, task_group_t>::iterator BestGroup(double *lpScore);
+	double Score(const task_t &stTask);
+	void Charge(task_t &stTask);
+	void TaskDone(task_t &stTask);
+	bool NextTask(unsigned int dwIndex, task_t &stTask);
+	bool PushLocal(task_t &stTask);
+	bool PeekLocal(unsigned int dwIndex, task_t &stTask);
+	bool PopLocal(unsigned int dwIndex, task_t &stTask);
+	bool Steal(unsigned int dwIndex, task_t &stTask);
+	void WakeWorker();
+	bool DrainResults();
+	void NotifyConsumer();
+
+	/* shared scheduler, protected by stMutex */
+	std::list<task_t> aTasks[TASK_LANE_MAX];
+	std::unordered_map<unsigned long, task_group_t> aGroups; // grouped construction tasks
+	double aLanePass[TASK_LANE_MAX];
+	double aLaneStride[TASK_LANE_MAX];
+	double dVirtualTime;
+	size_t dwNumGrouped;
+	std::atomic<unsigned long long> qwSequence;
+	std::atomic<size_t> dwNumGlobal;
+
+	/*
+	 * results : producers push onto a lock-free stack,
+	 * the (single) consumer takes the whole stack at once and keeps the batch in aResults
+	 */
+	std::atomic<result_node_t *> lpResultHead;
+	std::atomic<bool> bConsumerWaiting;
 	std::list<ThreadTaskResult> aResults;
+	std::mutex stResultMutex;
+	std::condition_variable stYield;
+
+	std::vector<worker_t *> aWorkers;
 	std::list<std::thread> aThreads;
 	std::mutex stMutex;
 	std::condition_variable stCondition;
 	std::condition_variable stSynchronize;
-	std::condition_variable stYield;
-	int dwNumSynchronized;
-	int dwNumActive;
+	/* tasks queued anywhere (shared scheduler and worker heaps) */
+	std::atomic<int> dwNumPending;
+	std::atomic<int> dwNumSleeping;
+	std::atomic<int> dwNumActive;
+	bool bExit;
+
+	/* statistics */
+	atomic_histogram_t aQueueLatency[TASK_KIND_MAX];
+	atomic_histogram_t aRunTime[TASK_KIND_MAX];
+	atomic_histogram_t stSchedulerLockWait;
+	static atomic_histogram_t stApiLockWait; // reset by each new pool, see ThreadPoolImpl()
+	std::atomic<unsigned long long> qwIdleTime;
+	std::atomic<unsigned long long> qwNumSteals;
+	std::atomic<unsigned long long> qwLastSample;
+	std::atomic<unsigned long long> qwSampleInterval;
+	unsigned long long qwStartTime;
+	std::vector<queue_sample_t> aQueueSamples;
+	std::mutex stStatisticsMutex;
 };
\ No newline at end of file
@@ -11,6 +11,8 @@ class BacklogImpl;
 class BlockPermutationEvaluatorImpl;
 class BlockPermutationEvaluationResultImpl;
 class BrokerImpl;
+class CancellationTokenImpl;
+class CandidateScanImpl;
 class CodeBrokerImpl;
 class ConditionImpl;
 class DFGAddImpl;
@@ -32,10 +34,13 @@ class DFGShiftImpl;
 class DFGStoreImpl;
 class DFGXorImpl;
 class EmptyAnalysisResultImpl;
+class FunctionContextImpl;
+class MatchPlanImpl;
 class OpaqueAssignmentImpl;
 class PathOracleImpl;
 class PredicateImpl;
 class ProcessorImpl;
+class SearchSplitImpl;
 class SignatureDefinitionImpl;
 class SignatureBrokerImpl;
 class SignatureParserImpl;
@@ -45,6 +50,7 @@ class SparseMatrixImpl;
 class ThreadPoolImpl;
 class ThreadTaskImpl;
 class ThreadTaskResultImpl;
+class VerdictSetImpl;
 
 typedef rfc_ptr<AbstractEvaluationResultImpl> AbstractEvaluationResult;
 typedef rfc_ptr<AbstractEvaluatorImpl> AbstractEvaluator;
@@ -56,6 +62,8 @@ typedef rfc_ptr<BacklogImpl> Backlog;
 typedef rfc_ptr<BlockPermutationEvaluatorImpl> BlockPermutationEvaluator;
 typedef rfc_ptr<BlockPermutationEvaluationResultImpl> BlockPermutationEvaluationResult;
 typedef rfc_ptr<BrokerImpl> Broker;
+typedef rfc_ptr<CancellationTokenImpl> CancellationToken;
+typedef rfc_ptr<CandidateScanImpl> CandidateScan;
 typedef rfc_ptr<CodeBrokerImpl> CodeBroker;
 typedef rfc_ptr<ConditionImpl> Condition;
 typedef rfc_ptr<DFGAddImpl> DFGAdd;
@@ -77,10 +85,13 @@ typedef rfc_ptr<DFGShiftImpl> DFGShift;
 typedef rfc_ptr<DFGStoreImpl> DFGStore;
 typedef rfc_ptr<DFGXorImpl> DFGXor;
 typedef rfc_ptr<EmptyAnalysisResultImpl> EmptyAnalysisResult;
+typedef rfc_ptr<FunctionContextImpl> FunctionContext;
+typedef rfc_ptr<MatchPlanImpl> MatchPlan;
 typedef rfc_ptr<OpaqueAssignmentImpl> OpaqueAssignment;
 typedef rfc_ptr<PathOracleImpl> PathOracle;
 typedef rfc_ptr<PredicateImpl> Predicate;
 typedef rfc_ptr<ProcessorImpl> Processor;
+typedef rfc_ptr<SearchSplitImpl> SearchSplit;
 typedef rfc_ptr<SignatureDefinitionImpl> SignatureDefinition;
 typedef rfc_ptr<SignatureBrokerImpl> SignatureBroker;
 typedef rfc_ptr<SignatureParserImpl> SignatureParser;
@@ -90,3 +101,4 @@ typedef rfc_ptr<SparseMatrixImpl> SparseMatrix;
 typedef rfc_ptr<ThreadPoolImpl> ThreadPool;
 typedef rfc_ptr<ThreadTaskImpl> ThreadTask;
 typedef rfc_ptr<ThreadTaskResultImpl> ThreadTaskResult;
+typedef rfc_ptr<VerdictSetImpl> VerdictSet;